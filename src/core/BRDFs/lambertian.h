@@ -4,6 +4,7 @@
 #include "multijittered.h"
 #include "pure_random.h"
 #include "jittered.h"
+#include "sobol_sampler.h"
 #include "constant_texture.h"
 
 namespace raytracer
@@ -23,7 +24,7 @@ namespace raytracer
         {
             kd = 1;
             cd =  std::make_shared<ConstantTexture>(Color::black);
-            sampler = std::make_shared<Jittered>(50);
+            sampler = std::make_shared<SobolSampler>();
             sampler->map_samples_to_hemisphere(1);
         }
 
@@ -34,9 +35,9 @@ namespace raytracer
 
         inline Eigen::Vector3f random_cosine_direction() const
         {
-            // Point2 s = sampler->sample_unit_square();
-            float r1 = random_float();
-            float r2 = random_float();
+            Eigen::Vector2f s = sampler->sample_unit_square();
+            float r1 = s.x();
+            float r2 = s.y();
 
             float phi = 2 * pi * r1;
             float x = cos(phi) * sqrt(r2);
@@ -52,7 +53,7 @@ namespace raytracer
             Eigen::Vector3f v = (Eigen::Vector3f(0.0034f, 1.0f, 0.0071f).cross(w)).normalized();
             Eigen::Vector3f u = v.cross(w);
 
-            Eigen::Vector3f sp = random_cosine_direction(); //sampler->sample_hemisphere();
+            Eigen::Vector3f sp = random_cosine_direction();
             wi = (sp.x() * u + sp.y() * v + sp.z() * w).normalized();
 
             pdf = hi.normal.dot(wi) * inv_pi;
@@ -1,10 +1,10 @@
 #include "thinlens.h"
 #include "pinhole.h"
-#include "multijittered.h"
+#include "sobol_sampler.h"
 using namespace raytracer;
 
 ThinLens::ThinLens(Eigen::Vector3f eye_p, Eigen::Vector3f lookat) : raytracer::Pinhole(eye_p, lookat),
-                                                  sampler_ptr(new raytracer::MultiJittered(4))
+                                                  sampler_ptr(new raytracer::SobolSampler())
 {
     sampler_ptr->map_samples_to_unit_disk();
 }
@@ -0,0 +1,58 @@
+#pragma once
+#include <vector>
+#include <algorithm>
+
+#include "color.h"
+
+namespace raytracer
+{
+    /*
+     *  The unclamped, linear sum of the samples taken in every pixel and how many there were, so a
+     *  render can go on adding samples pass after pass and be looked at or saved at any point.
+     *  Rows and columns are those of the camera, row 0 at the bottom of the image.
+     *  Threads may add to different pixels at the same time, but not to the same pixel.
+     */
+    class Film
+    {
+    public:
+        Film(int width, int height) : width(width), height(height), sums(width * height, Color(0, 0, 0)), counts(width * height, 0) {}
+
+        int get_width() const { return width; }
+        int get_height() const { return height; }
+
+        // Adds the sum of nr_samples more samples of a pixel
+        void add_samples(int row, int col, const Color &sum, int nr_samples)
+        {
+            sums[row * width + col] += sum;
+            counts[row * width + col] += nr_samples;
+        }
+
+        int sample_count(int row, int col) const { return counts[row * width + col]; }
+
+        // The mean of the samples taken so far, black if there are none
+        Color average(int row, int col) const
+        {
+            int n = counts[row * width + col];
+            return n > 0 ? sums[row * width + col] / n : Color(0, 0, 0);
+        }
+
+        // The average as an 8-bit sRGB color for the preview and the saved image
+        Color display_color(int row, int col) const
+        {
+            return Clamp(average(row, col), 0.0, 1.0).gamma_corrected() * 255.0;
+        }
+
+        // The fewest and most samples taken in any pixel, which differ if a pass was cut short
+        void sample_count_range(int &min_samples, int &max_samples) const
+        {
+            auto range = std::minmax_element(counts.begin(), counts.end());
+            min_samples = *range.first;
+            max_samples = *range.second;
+        }
+
+    private:
+        int width, height;
+        std::vector<Color> sums;
+        std::vector<int> counts;
+    };
+}
@@ -16,16 +16,9 @@ Color AreaLight::L(const Ray &r_in, const HitInfo &rec, Eigen::Vector3f &sample_
 }
 
 bool AreaLight::occluded(const Ray &ray, const HitInfo &rec, Eigen::Vector3f &sample_point, Eigen::Vector3f &light_normal, Eigen::Vector3f &wi) const {
-    float t;
-    int num_objects = rec.world.objects.size();
+    // Only blockers strictly between the shading point and the light count, not the light itself
     float ts = (sample_point - ray.origin).dot(ray.direction);
-    HitInfo rec2(rec.world);
-    for (int i = 0 ; i < rec.world.objects.size(); i++)
-    {
-        bool hit = rec.world.hit_objects(ray, Interval(0.0001, infinity), rec2);
-        if (hit && rec2.t < ts) return true;
-    }
-    return false;
+    return rec.world.shadow_hit_objects(ray, Interval(0.0001, ts - 0.0001));
 }
 
 float AreaLight::pdf(const HitInfo &rec, const Eigen::Vector3f &wi) const 
@@ -45,4 +38,24 @@ Color AreaLight::Sample_Li(const Ray &r_in, const HitInfo &rec, Eigen::Vector3f
     Ray shadow_ray = Ray(rec.p, wi);
     in_shadow = occluded(shadow_ray, rec, sample_point, light_normal, wi);
     return L(r_in, rec, sample_point, light_normal, wi);
-}
\ No newline at end of file
+}
+
+void AreaLight::Sample_Li_packet(const Ray &r_in, const HitInfo &rec, int n, Color *Li, Eigen::Vector3f *sample_points, Eigen::Vector3f *light_normals, Eigen::Vector3f *wi, float *pdf, bool *in_shadow) const
+{
+    RayPacket shadow_rays;
+    for (int k = 0; k < n; k++)
+    {
+        sample_points[k] = object->sample();
+        light_normals[k] = object->get_normal(sample_points[k]);
+        wi[k] = (sample_points[k] - rec.p).normalized();
+        pdf[k] = this->pdf(rec, wi[k]);
+        Li[k] = L(r_in, rec, sample_points[k], light_normals[k], wi[k]);
+
+        float ts = (sample_points[k] - rec.p).dot(wi[k]);
+        shadow_rays.add(Ray(rec.p, wi[k]), Interval(0.0001, ts - 0.0001));
+    }
+
+    int blocked = rec.world.shadow_hit_objects_packet(shadow_rays);
+    for (int k = 0; k < n; k++)
+        in_shadow[k] = (blocked >> k) & 1;
+}
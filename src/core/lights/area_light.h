@@ -24,6 +24,9 @@ namespace raytracer
 
         Color Sample_Li(const Ray &r_in, const HitInfo &rec, Eigen::Vector3f &sample_point, Eigen::Vector3f &light_normal, Eigen::Vector3f &wi, float &pdf, bool &in_shadow) const override;
 
+        // The shadow rays of all the samples leave the same point towards the same light, so they are traced as one packet
+        void Sample_Li_packet(const Ray &r_in, const HitInfo &rec, int n, Color *Li, Eigen::Vector3f *sample_points, Eigen::Vector3f *light_normals, Eigen::Vector3f *wi, float *pdf, bool *in_shadow) const override;
+
         Color L(const Ray &r_in, const HitInfo &rec, Eigen::Vector3f &sample_point, Eigen::Vector3f &light_normal, Eigen::Vector3f &wi) const override;
         
         
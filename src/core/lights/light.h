@@ -19,5 +19,15 @@ namespace raytracer
         
         virtual float pdf(const HitInfo &rec, const Eigen::Vector3f &wi) const = 0;
         virtual bool occluded(const Ray &r, const HitInfo &rec, Eigen::Vector3f &sample_point, Eigen::Vector3f &light_normal, Eigen::Vector3f &wi) const = 0;
+
+        // How many samples of the light are taken per shading point, at most RayPacket::max_size
+        int num_samples = 1;
+
+        // Sample_Li for n samples at once, the k-th sample is written to the k-th element of every array
+        virtual void Sample_Li_packet(const Ray &r_in, const HitInfo &rec, int n, Color *Li, Eigen::Vector3f *sample_points, Eigen::Vector3f *light_normals, Eigen::Vector3f *wi, float *pdf, bool *in_shadow) const
+        {
+            for (int k = 0; k < n; k++)
+                Li[k] = Sample_Li(r_in, rec, sample_points[k], light_normals[k], wi[k], pdf[k], in_shadow[k]);
+        }
     };
 }
\ No newline at end of file
@@ -5,6 +5,7 @@
 #include "geometric_object.h"
 #include "multijittered.h"
 #include "pure_random.h"
+#include "sobol_sampler.h"
 #include "tracer.h"
 
 // #include "Tracy.hpp"
@@ -25,7 +26,7 @@ namespace raytracer
     public:
         Matte()
         {
-            sampler = std::make_shared<MultiJittered>(50);
+            sampler = std::make_shared<SobolSampler>();
             sampler->map_samples_to_sphere();
         }
 
@@ -38,7 +39,7 @@ namespace raytracer
             diffuse_brdf = l;
             if (sampler == NULL)
             {
-                sampler = std::make_shared<MultiJittered>(50);
+                sampler = std::make_shared<SobolSampler>();
                 sampler->map_samples_to_sphere();
             }
         }
@@ -49,7 +50,7 @@ namespace raytracer
             this->diffuse_brdf.set_cd(cd);
             if (sampler == NULL)
             {
-                sampler = std::make_shared<MultiJittered>(50);
+                sampler = std::make_shared<SobolSampler>();
                 sampler->map_samples_to_sphere();
             }
         }
@@ -61,30 +62,21 @@ namespace raytracer
             this->diffuse_brdf.set_cd(tex);
             if (sampler == NULL)
             {
-                sampler = std::make_shared<MultiJittered>(50);
+                sampler = std::make_shared<SobolSampler>();
                 sampler->map_samples_to_sphere();
             }
         }
 
         void set_sampler(std::shared_ptr<Sampler> s)
         {
-            this->sampler = sampler;
+            this->sampler = s;
             sampler->map_samples_to_sphere();
         }
 
-        inline Eigen::Vector3f random_in_unit_sphere() const
-        {
-            while (true)
-            {
-                auto p = Eigen::Vector3f(random_float(-1, 1), random_float(-1, 1), random_float(-1, 1));
-                if (p.squaredNorm() < 1)
-                    return p;
-            }
-        }
-
+        // Uniform on the unit sphere
         inline Eigen::Vector3f random_unit_vector() const
         {
-            return (random_in_unit_sphere()).normalized();
+            return sampler->sample_sphere();
         }
 
         /*
@@ -112,34 +104,46 @@ namespace raytracer
                 Color Ld(0.0, 0.0, 0.0);
 
                 // Sample light source with multiple importance sampling
-                Eigen::Vector3f sample_point;
-                Eigen::Vector3f light_normal;
-                Eigen::Vector3f light_dir;
-                bool in_shadow;
+                const int n = std::max(1, std::min(rec.world.lights[i]->num_samples, (int)RayPacket::max_size));
+                Color Li_samples[RayPacket::max_size];
+                Eigen::Vector3f sample_points[RayPacket::max_size];
+                Eigen::Vector3f light_normals[RayPacket::max_size];
+                Eigen::Vector3f wis[RayPacket::max_size];
+                float light_pdfs[RayPacket::max_size];
+                bool in_shadow[RayPacket::max_size];
+                rec.world.lights[i]->Sample_Li_packet(r_in, rec, n, Li_samples, sample_points, light_normals, wis, light_pdfs, in_shadow);
+
+                Eigen::Vector3f sample_point = sample_points[0];
+                Eigen::Vector3f light_normal = light_normals[0];
                 Eigen::Vector3f wi;
                 float light_pdf = 0.0, scattering_pdf = 0.0;
-                Color Li = rec.world.lights[i]->Sample_Li(r_in, rec, sample_point, light_normal, wi, light_pdf, in_shadow);
-
-                if (light_pdf > 0.0 && !Li.is_black())
+                for (int k = 0; k < n; k++)
                 {
+                    Color Li = Li_samples[k];
+                    light_pdf = light_pdfs[k];
+                    wi = wis[k];
+                    if (light_pdf > 0.0 && !Li.is_black())
+                    {
 
-                    // Compute BRDF for light sample
-                    Color f = diffuse_brdf.f(rec, wo, wi) * fabs(wi.dot(rec.normal));
-
-                    // The pdf for lambertian is trivial
-                    scattering_pdf = rec.normal.dot(wi) * inv_pi;
+                        // Compute BRDF for light sample
+                        Color f = diffuse_brdf.f(rec, wo, wi) * fabs(wi.dot(rec.normal));
 
-                    if (!f.is_black())
-                    {
-                        // Check visibility
-                        if (in_shadow)
-                            Li = Color::black;
+                        // The pdf for lambertian is trivial
+                        scattering_pdf = rec.normal.dot(wi) * inv_pi;
 
-                        // Add light's contribution to reflected radiance
-                        if (!Li.is_black())
+                        if (!f.is_black())
                         {
-                            float weight = power_heuristic(1, light_pdf, 1, scattering_pdf);
-                            Ld += f * Li * weight / light_pdf;
+                            // Check visibility
+                            if (in_shadow[k])
+                                Li = Color::black;
+
+                            // Add light's contribution to reflected radiance, averaged over the light samples
+                            if (!Li.is_black())
+                            {
+                                // The n light samples are weighed against the single BRDF sample
+                                float weight = power_heuristic(n, light_pdf, 1, scattering_pdf);
+                                Ld += f * Li * weight / (light_pdf * n);
+                            }
                         }
                     }
                 }
@@ -161,7 +165,7 @@ namespace raytracer
                         pixel_color += Ld;
                         continue;
                     }
-                    weight = power_heuristic(1, scattering_pdf, 1, light_pdf);
+                    weight = power_heuristic(1, scattering_pdf, n, light_pdf);
 
                     // Add light contribution from material sampling
                     Color Li = rec.world.lights[i]->L(r_in, rec, sample_point, light_normal, wi);
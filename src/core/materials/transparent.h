@@ -1,6 +1,7 @@
 #pragma once
 #include "material.h"
 #include "geometric_object.h"
+#include "sobol_sampler.h"
 
 namespace raytracer
 {
@@ -10,6 +11,7 @@ namespace raytracer
         Transparent(double ir)
         {
             this->ir = ir;
+            sampler = std::make_shared<SobolSampler>();
         }
 
         bool scatter(const Ray &r_in, const HitInfo &rec, Color &attenuation, Ray &scattered) const override
@@ -23,7 +25,7 @@ namespace raytracer
 
             bool cannot_refract = refraction_ratio * sin_theta > 1.0;
             Eigen::Vector3f direction;
-            if (cannot_refract || reflectance(cos_theta, refraction_ratio) > random_float())
+            if (cannot_refract || reflectance(cos_theta, refraction_ratio) > sampler->sample_1d())
                 direction = Reflect(unit_direction, rec.normal);
             else
                 direction = Refract(unit_direction, rec.normal, refraction_ratio);
@@ -39,6 +41,7 @@ namespace raytracer
 
     private:
         float ir; // index of refraction
+        std::shared_ptr<Sampler> sampler; // chooses between reflection and refraction
 
         static float reflectance(float cosine, float ref_idx)
         {
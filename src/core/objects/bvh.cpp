@@ -0,0 +1,1408 @@
+#include <algorithm>
+#include <cstdint>
+#include <cmath>
+#include "bvh.h"
+#include "thread_pool.h"
+#include "clock_util.h"
+#include "console.h"
+using namespace raytracer;
+
+// Subtrees over fewer primitives than this are built on the thread that split their parent
+static const size_t min_parallel_build_size = 4096;
+
+struct BVHPrimitiveInfo
+{
+    int index;
+    Eigen::AlignedBox3f bounds;
+    Eigen::Vector3f centroid;
+};
+
+// Chooses a split for the primitives in [start, end) with the binned Surface Area Heuristic
+// and partitions them in place. Returns the index of the first primitive of the second
+// child, or -1 if the node is cheaper to intersect as a leaf.
+static long partition_sah(std::vector<BVHPrimitiveInfo> &info, size_t start, size_t end, const Eigen::AlignedBox3f &bounds,
+                          const Eigen::AlignedBox3f &centroid_bounds, int axis, const BVHBuildParams &params)
+{
+    size_t n_primitives = end - start;
+    float extent = centroid_bounds.max()[axis] - centroid_bounds.min()[axis];
+
+    if (extent <= 0.0f)
+    {
+        // All the centroids are on top of each other, no split can separate them
+        if (n_primitives <= (size_t)params.max_leaf_size)
+            return -1;
+        return start + n_primitives / 2;
+    }
+
+    // Bin the primitives by the position of their centroid along the split axis
+    const int num_bins = params.num_bins;
+    std::vector<int> bin_count(num_bins, 0);
+    std::vector<Eigen::AlignedBox3f> bin_bounds(num_bins);
+    float min_c = centroid_bounds.min()[axis];
+
+    auto bin_index = [&](const BVHPrimitiveInfo &p)
+    {
+        int b = (int)(num_bins * ((p.centroid[axis] - min_c) / extent));
+        return std::min(b, num_bins - 1);
+    };
+
+    for (size_t i = start; i < end; i++)
+    {
+        int b = bin_index(info[i]);
+        bin_count[b]++;
+        bin_bounds[b].extend(info[i].bounds);
+    }
+
+    // Sweep from the right to get the area and count of every right-hand side,
+    // then from the left evaluating the cost of splitting after each bin
+    std::vector<float> right_area(num_bins, 0.0f);
+    std::vector<int> right_count(num_bins, 0);
+    Eigen::AlignedBox3f right_box;
+    int count = 0;
+    for (int b = num_bins - 1; b > 0; b--)
+    {
+        right_box.extend(bin_bounds[b]);
+        count += bin_count[b];
+        right_area[b] = surface_area(right_box);
+        right_count[b] = count;
+    }
+
+    float inv_area = 1.0f / surface_area(bounds);
+    float min_cost = infinity;
+    int min_bin = -1;
+    Eigen::AlignedBox3f left_box;
+    count = 0;
+    for (int b = 0; b < num_bins - 1; b++)
+    {
+        left_box.extend(bin_bounds[b]);
+        count += bin_count[b];
+        if (count == 0 || right_count[b + 1] == 0)
+            continue;
+        float cost = params.traversal_cost + params.intersection_cost * inv_area *
+                                                 (count * surface_area(left_box) + right_count[b + 1] * right_area[b + 1]);
+        if (cost < min_cost)
+        {
+            min_cost = cost;
+            min_bin = b;
+        }
+    }
+
+    if (min_bin < 0)
+    {
+        if (n_primitives <= (size_t)params.max_leaf_size)
+            return -1;
+        return start + n_primitives / 2;
+    }
+
+    float leaf_cost = params.intersection_cost * n_primitives;
+    if (n_primitives <= (size_t)params.max_leaf_size && leaf_cost <= min_cost)
+        return -1;
+
+    auto mid = std::partition(info.begin() + start, info.begin() + end,
+                              [&](const BVHPrimitiveInfo &p)
+                              { return bin_index(p) <= min_bin; });
+    return mid - info.begin();
+}
+
+// Appends the nodes of a subtree built separately, whose own indices start at 0
+static void append_subtree(std::vector<LinearBVHNode> &nodes, const std::vector<LinearBVHNode> &subtree)
+{
+    int base = nodes.size();
+    for (LinearBVHNode node : subtree)
+    {
+        if (node.n_primitives == 0)
+            node.second_child_offset += base;
+        nodes.push_back(node);
+    }
+}
+
+// Builds the subtree over [start, end) and appends it to nodes in depth-first order.
+// The primitives are partitioned in place, so subtrees over disjoint ranges can be built
+// concurrently: large ones are built into their own arrays on the thread pool and
+// appended once finished. Returns the index of the subtree's root.
+static int recursive_build(std::vector<BVHPrimitiveInfo> &info, size_t start, size_t end, const BVHBuildParams &params,
+                           std::vector<LinearBVHNode> &nodes, int depth)
+{
+    int node_index = nodes.size();
+    nodes.emplace_back();
+
+    Eigen::AlignedBox3f bounds, centroid_bounds;
+    for (size_t i = start; i < end; i++)
+    {
+        bounds.extend(info[i].bounds);
+        centroid_bounds.extend(info[i].centroid);
+    }
+
+    // Split along the axis where the centroids are spread the most
+    int axis;
+    (centroid_bounds.max() - centroid_bounds.min()).maxCoeff(&axis);
+
+    long mid = -1;
+    if (end - start > 1 && depth < max_bvh_depth - 32)
+        mid = partition_sah(info, start, end, bounds, centroid_bounds, axis, params);
+    else if (end - start > (size_t)params.max_leaf_size)
+    {
+        // Pathologically deep tree, median splits keep the remaining depth below 32
+        mid = start + (end - start) / 2;
+        std::nth_element(info.begin() + start, info.begin() + mid, info.begin() + end,
+                         [axis](const BVHPrimitiveInfo &a, const BVHPrimitiveInfo &b)
+                         { return a.centroid[axis] < b.centroid[axis]; });
+    }
+
+    // Don't hold references into nodes across the recursive calls, they may reallocate it
+    nodes[node_index].bounds = bounds;
+    if (mid < 0)
+    {
+        nodes[node_index].primitives_offset = start;
+        nodes[node_index].n_primitives = end - start;
+        nodes[node_index].axis = 0;
+        return node_index;
+    }
+
+    int second_child;
+    if (end - start >= min_parallel_build_size)
+    {
+        ThreadPool *pool = ThreadPool::GetInstance();
+        std::vector<LinearBVHNode> left_nodes, right_nodes;
+        auto left_done = pool->submit([&]
+                                      { recursive_build(info, start, mid, params, left_nodes, depth + 1); });
+        recursive_build(info, mid, end, params, right_nodes, depth + 1);
+        pool->wait(left_done);
+
+        append_subtree(nodes, left_nodes);
+        second_child = nodes.size();
+        append_subtree(nodes, right_nodes);
+    }
+    else
+    {
+        recursive_build(info, start, mid, params, nodes, depth + 1);
+        second_child = recursive_build(info, mid, end, params, nodes, depth + 1);
+    }
+    nodes[node_index].second_child_offset = second_child;
+    nodes[node_index].n_primitives = 0;
+    nodes[node_index].axis = axis;
+    return node_index;
+}
+
+struct MortonPrimitive
+{
+    int index;
+    uint64_t code;
+};
+
+// Spreads the lowest 10 bits of x so that there are two zero bits between each of them
+static inline uint64_t left_shift_3_10(uint32_t x)
+{
+    x &= 0x3ff;
+    x = (x | (x << 16)) & 0x030000ff;
+    x = (x | (x << 8)) & 0x0300f00f;
+    x = (x | (x << 4)) & 0x030c30c3;
+    x = (x | (x << 2)) & 0x09249249;
+    return x;
+}
+
+// Spreads the lowest 21 bits of x so that there are two zero bits between each of them
+static inline uint64_t left_shift_3_21(uint64_t x)
+{
+    x &= 0x1fffff;
+    x = (x | (x << 32)) & 0x1f00000000ffffull;
+    x = (x | (x << 16)) & 0x1f0000ff0000ffull;
+    x = (x | (x << 8)) & 0x100f00f00f00f00full;
+    x = (x | (x << 4)) & 0x10c30c30c30c30c3ull;
+    x = (x | (x << 2)) & 0x1249249249249249ull;
+    return x;
+}
+
+// Interleaves the quantized coordinates of p, given relative to the centroid bounds in [0, 1]^3.
+// Bit b of the code belongs to axis b % 3.
+static inline uint64_t encode_morton(const Eigen::Vector3f &p, int morton_bits)
+{
+    if (morton_bits > 30)
+    {
+        const float scale = 1 << 21;
+        uint64_t x = std::min(std::max(p.x() * scale, 0.0f), scale - 1);
+        uint64_t y = std::min(std::max(p.y() * scale, 0.0f), scale - 1);
+        uint64_t z = std::min(std::max(p.z() * scale, 0.0f), scale - 1);
+        return (left_shift_3_21(z) << 2) | (left_shift_3_21(y) << 1) | left_shift_3_21(x);
+    }
+    const float scale = 1 << 10;
+    uint32_t x = std::min(std::max(p.x() * scale, 0.0f), scale - 1);
+    uint32_t y = std::min(std::max(p.y() * scale, 0.0f), scale - 1);
+    uint32_t z = std::min(std::max(p.z() * scale, 0.0f), scale - 1);
+    return (left_shift_3_10(z) << 2) | (left_shift_3_10(y) << 1) | left_shift_3_10(x);
+}
+
+// Least significant digit radix sort of the primitives by their Morton code, 8 bits per pass.
+// Every pass histograms and scatters contiguous chunks of the array in parallel; the
+// chunks write to disjoint ranges of the output, which keeps the sort stable.
+static void radix_sort(std::vector<MortonPrimitive> &v, int n_bits)
+{
+    const int bits_per_pass = 8;
+    const int n_buckets = 1 << bits_per_pass;
+    const int n_passes = (n_bits + bits_per_pass - 1) / bits_per_pass;
+
+    ThreadPool *pool = ThreadPool::GetInstance();
+    const size_t n_chunks = std::min((size_t)pool->size() + 1, (v.size() + 16383) / 16384);
+    const size_t chunk_size = (v.size() + n_chunks - 1) / n_chunks;
+
+    std::vector<MortonPrimitive> temp(v.size());
+    std::vector<std::vector<size_t>> offsets(n_chunks, std::vector<size_t>(n_buckets));
+    for (int pass = 0; pass < n_passes; pass++)
+    {
+        const int low_bit = pass * bits_per_pass;
+        std::vector<MortonPrimitive> &in = (pass & 1) ? temp : v;
+        std::vector<MortonPrimitive> &out = (pass & 1) ? v : temp;
+
+        pool->parallel_for(0, n_chunks, 1, [&](size_t c)
+                           {
+            std::fill(offsets[c].begin(), offsets[c].end(), 0);
+            size_t chunk_end = std::min(in.size(), (c + 1) * chunk_size);
+            for (size_t i = c * chunk_size; i < chunk_end; i++)
+                offsets[c][(in[i].code >> low_bit) & (n_buckets - 1)]++; });
+
+        // Turn the per chunk counts into the position each chunk starts writing a bucket at
+        size_t offset = 0;
+        for (int b = 0; b < n_buckets; b++)
+            for (size_t c = 0; c < n_chunks; c++)
+            {
+                size_t count = offsets[c][b];
+                offsets[c][b] = offset;
+                offset += count;
+            }
+
+        pool->parallel_for(0, n_chunks, 1, [&](size_t c)
+                           {
+            size_t chunk_end = std::min(in.size(), (c + 1) * chunk_size);
+            for (size_t i = c * chunk_size; i < chunk_end; i++)
+                out[offsets[c][(in[i].code >> low_bit) & (n_buckets - 1)]++] = in[i]; });
+    }
+    if (n_passes & 1)
+        std::swap(v, temp);
+}
+
+// Emits the hierarchy over the Morton sorted primitives [start, end), whose codes all agree
+// above bit. Each node splits its range where the highest differing bit changes from 0 to 1,
+// which is found with a binary search since the codes are sorted. Returns the root index.
+static int emit_lbvh(const std::vector<MortonPrimitive> &sorted, const std::vector<Eigen::AlignedBox3f> &sorted_bounds,
+                     size_t start, size_t end, int bit, const BVHBuildParams &params, std::vector<LinearBVHNode> &nodes)
+{
+    size_t n_primitives = end - start;
+    size_t split;
+    if (n_primitives <= (size_t)params.max_leaf_size)
+        split = start;
+    else if (bit < 0)
+        split = start + n_primitives / 2; // identical codes, split anywhere
+    else
+    {
+        uint64_t mask = 1ull << bit;
+        if ((sorted[start].code & mask) == (sorted[end - 1].code & mask))
+            return emit_lbvh(sorted, sorted_bounds, start, end, bit - 1, params, nodes);
+
+        size_t lo = start, hi = end - 1;
+        while (lo + 1 != hi)
+        {
+            size_t mid = (lo + hi) / 2;
+            if ((sorted[lo].code & mask) == (sorted[mid].code & mask))
+                lo = mid;
+            else
+                hi = mid;
+        }
+        split = hi;
+    }
+
+    int node_index = nodes.size();
+    nodes.emplace_back();
+
+    if (split == start)
+    {
+        Eigen::AlignedBox3f bounds;
+        for (size_t i = start; i < end; i++)
+            bounds.extend(sorted_bounds[i]);
+        nodes[node_index].bounds = bounds;
+        nodes[node_index].primitives_offset = start;
+        nodes[node_index].n_primitives = n_primitives;
+        nodes[node_index].axis = 0;
+        return node_index;
+    }
+
+    int second_child;
+    if (n_primitives >= min_parallel_build_size)
+    {
+        ThreadPool *pool = ThreadPool::GetInstance();
+        std::vector<LinearBVHNode> left_nodes, right_nodes;
+        auto left_done = pool->submit([&]
+                                      { emit_lbvh(sorted, sorted_bounds, start, split, bit - 1, params, left_nodes); });
+        emit_lbvh(sorted, sorted_bounds, split, end, bit - 1, params, right_nodes);
+        pool->wait(left_done);
+
+        append_subtree(nodes, left_nodes);
+        second_child = nodes.size();
+        append_subtree(nodes, right_nodes);
+    }
+    else
+    {
+        emit_lbvh(sorted, sorted_bounds, start, split, bit - 1, params, nodes);
+        second_child = emit_lbvh(sorted, sorted_bounds, split, end, bit - 1, params, nodes);
+    }
+
+    Eigen::AlignedBox3f bounds = nodes[node_index + 1].bounds;
+    bounds.extend(nodes[second_child].bounds);
+    nodes[node_index].bounds = bounds;
+    nodes[node_index].second_child_offset = second_child;
+    nodes[node_index].n_primitives = 0;
+    nodes[node_index].axis = bit < 0 ? 0 : bit % 3;
+    return node_index;
+}
+
+// Builds the top of an HLBVH with SAH, treating every treelet as a single primitive
+static int build_upper_sah(std::vector<BVHPrimitiveInfo> &treelet_info, size_t start, size_t end, const BVHBuildParams &params,
+                           const std::vector<std::vector<LinearBVHNode>> &treelets, std::vector<LinearBVHNode> &nodes, int depth)
+{
+    if (end - start == 1)
+    {
+        int root = nodes.size();
+        append_subtree(nodes, treelets[treelet_info[start].index]);
+        return root;
+    }
+
+    Eigen::AlignedBox3f bounds, centroid_bounds;
+    for (size_t i = start; i < end; i++)
+    {
+        bounds.extend(treelet_info[i].bounds);
+        centroid_bounds.extend(treelet_info[i].centroid);
+    }
+    int axis;
+    (centroid_bounds.max() - centroid_bounds.min()).maxCoeff(&axis);
+
+    // Every treelet must end up alone, and the treelets hang below these levels,
+    // so their depth is kept in check with median splits
+    long mid = -1;
+    if (depth < 32)
+    {
+        BVHBuildParams upper_params = params;
+        upper_params.max_leaf_size = 1;
+        mid = partition_sah(treelet_info, start, end, bounds, centroid_bounds, axis, upper_params);
+    }
+    if (mid < 0)
+    {
+        mid = start + (end - start) / 2;
+        std::nth_element(treelet_info.begin() + start, treelet_info.begin() + mid, treelet_info.begin() + end,
+                         [axis](const BVHPrimitiveInfo &a, const BVHPrimitiveInfo &b)
+                         { return a.centroid[axis] < b.centroid[axis]; });
+    }
+
+    int node_index = nodes.size();
+    nodes.emplace_back();
+    build_upper_sah(treelet_info, start, mid, params, treelets, nodes, depth + 1);
+    int second_child = build_upper_sah(treelet_info, mid, end, params, treelets, nodes, depth + 1);
+    nodes[node_index].bounds = bounds;
+    nodes[node_index].second_child_offset = second_child;
+    nodes[node_index].n_primitives = 0;
+    nodes[node_index].axis = axis;
+    return node_index;
+}
+
+static void build_morton_bvh(const std::vector<Eigen::AlignedBox3f> &prim_bounds, const BVHBuildParams &params,
+                             std::vector<LinearBVHNode> &nodes, std::vector<int> &ordered_prims)
+{
+    ThreadPool *pool = ThreadPool::GetInstance();
+    const int morton_bits = params.morton_bits > 30 ? 63 : 30;
+
+    Eigen::AlignedBox3f centroid_bounds;
+    for (const auto &b : prim_bounds)
+        centroid_bounds.extend(b.center());
+    Eigen::Vector3f inv_extent = (centroid_bounds.max() - centroid_bounds.min()).cwiseMax(1e-20f).cwiseInverse();
+
+    std::vector<MortonPrimitive> sorted(prim_bounds.size());
+    pool->parallel_for(0, sorted.size(), 16384, [&](size_t i)
+                       {
+        Eigen::Vector3f p = (prim_bounds[i].center() - centroid_bounds.min()).cwiseProduct(inv_extent);
+        sorted[i].index = i;
+        sorted[i].code = encode_morton(p, morton_bits); });
+
+    radix_sort(sorted, morton_bits);
+
+    // The primitives end up in Morton order, which is also the order the leaves reference them in
+    std::vector<Eigen::AlignedBox3f> sorted_bounds(sorted.size());
+    ordered_prims.resize(sorted.size());
+    pool->parallel_for(0, sorted.size(), 16384, [&](size_t i)
+                       {
+        sorted_bounds[i] = prim_bounds[sorted[i].index];
+        ordered_prims[i] = sorted[i].index; });
+
+    if (params.method == LBVH)
+    {
+        emit_lbvh(sorted, sorted_bounds, 0, sorted.size(), morton_bits - 1, params, nodes);
+        return;
+    }
+
+    // HLBVH: group the primitives into treelets sharing the top 12 bits of their code
+    // and build those in parallel, then join the treelet roots with SAH
+    const int treelet_bits = 12;
+    const int low_bits = morton_bits - treelet_bits;
+    std::vector<std::pair<size_t, size_t>> treelet_ranges;
+    for (size_t start = 0, end = 1; end <= sorted.size(); end++)
+    {
+        if (end == sorted.size() || (sorted[start].code >> low_bits) != (sorted[end].code >> low_bits))
+        {
+            treelet_ranges.push_back(std::make_pair(start, end));
+            start = end;
+        }
+    }
+
+    std::vector<std::vector<LinearBVHNode>> treelets(treelet_ranges.size());
+    std::vector<BVHPrimitiveInfo> treelet_info(treelet_ranges.size());
+    pool->parallel_for(0, treelet_ranges.size(), 1, [&](size_t i)
+                       {
+        emit_lbvh(sorted, sorted_bounds, treelet_ranges[i].first, treelet_ranges[i].second, low_bits - 1, params, treelets[i]);
+        treelet_info[i].index = i;
+        treelet_info[i].bounds = treelets[i][0].bounds;
+        treelet_info[i].centroid = treelets[i][0].bounds.center(); });
+
+    build_upper_sah(treelet_info, 0, treelet_info.size(), params, treelets, nodes, 0);
+}
+
+void raytracer::build_bvh(const std::vector<Eigen::AlignedBox3f> &prim_bounds, const BVHBuildParams &params,
+                          std::vector<LinearBVHNode> &nodes, std::vector<int> &ordered_prims, const PrimitiveClipper &clip)
+{
+    nodes.clear();
+    ordered_prims.clear();
+    if (prim_bounds.empty())
+        return;
+
+    if (params.method == LBVH || params.method == HLBVH)
+    {
+        build_morton_bvh(prim_bounds, params, nodes, ordered_prims);
+        nodes.shrink_to_fit();
+        return;
+    }
+
+    if (params.method == SBVH)
+    {
+        if (clip)
+            build_sbvh(prim_bounds, clip, params, nodes, ordered_prims);
+        else
+            build_sbvh(prim_bounds, [&prim_bounds](int prim, const Eigen::AlignedBox3f &box)
+                       { return prim_bounds[prim].intersection(box); }, params, nodes, ordered_prims);
+        nodes.shrink_to_fit();
+        return;
+    }
+
+    ThreadPool *pool = ThreadPool::GetInstance();
+    std::vector<BVHPrimitiveInfo> info(prim_bounds.size());
+    pool->parallel_for(0, info.size(), 16384, [&](size_t i)
+                       {
+        info[i].index = i;
+        info[i].bounds = prim_bounds[i];
+        info[i].centroid = prim_bounds[i].center(); });
+
+    recursive_build(info, 0, info.size(), params, nodes, 0);
+    nodes.shrink_to_fit();
+
+    ordered_prims.resize(info.size());
+    pool->parallel_for(0, info.size(), 16384, [&](size_t i)
+                       { ordered_prims[i] = info[i].index; });
+}
+
+// Creates the wide node covering the binary subtree rooted at node_index and returns its index
+static int collapse_node(const std::vector<LinearBVHNode> &nodes, int node_index, std::vector<WideBVHNode> &wide_nodes)
+{
+    int wide_index = wide_nodes.size();
+    wide_nodes.emplace_back();
+
+    int children[bvh_width];
+    int n_children = 0;
+    if (nodes[node_index].n_primitives > 0)
+        children[n_children++] = node_index; // a tree made of a single leaf
+    else
+    {
+        children[n_children++] = node_index + 1;
+        children[n_children++] = nodes[node_index].second_child_offset;
+    }
+
+    // Open up the interior child with the largest surface area until the node is full
+    while (n_children < bvh_width)
+    {
+        int best = -1;
+        float best_area = -1.0f;
+        for (int i = 0; i < n_children; i++)
+        {
+            const LinearBVHNode &child = nodes[children[i]];
+            if (child.n_primitives == 0 && surface_area(child.bounds) > best_area)
+            {
+                best = i;
+                best_area = surface_area(child.bounds);
+            }
+        }
+        if (best < 0)
+            break;
+
+        int opened = children[best];
+        children[best] = opened + 1;
+        children[n_children++] = nodes[opened].second_child_offset;
+    }
+
+    for (int i = 0; i < bvh_width; i++)
+    {
+        WideBVHNode &node = wide_nodes[wide_index];
+        if (i >= n_children)
+        {
+            for (int a = 0; a < 3; a++)
+            {
+                node.bounds[a][i] = infinity;
+                node.bounds[a + 3][i] = -infinity;
+            }
+            node.child[i] = -1;
+            node.count[i] = 0;
+            continue;
+        }
+
+        const LinearBVHNode &child = nodes[children[i]];
+        for (int a = 0; a < 3; a++)
+        {
+            node.bounds[a][i] = child.bounds.min()[a];
+            node.bounds[a + 3][i] = child.bounds.max()[a];
+        }
+        node.count[i] = child.n_primitives;
+        if (child.n_primitives > 0)
+            node.child[i] = child.primitives_offset;
+        else
+        {
+            // Don't hold the reference across the call, it may reallocate wide_nodes
+            int child_index = collapse_node(nodes, children[i], wide_nodes);
+            wide_nodes[wide_index].child[i] = child_index;
+        }
+    }
+    return wide_index;
+}
+
+void raytracer::collapse_bvh(const std::vector<LinearBVHNode> &nodes, std::vector<WideBVHNode> &wide_nodes)
+{
+    wide_nodes.clear();
+    if (nodes.empty())
+        return;
+    collapse_node(nodes, 0, wide_nodes);
+    wide_nodes.shrink_to_fit();
+}
+
+// Quantizes the child boxes of a wide node against their union, rounding every plane outwards
+static void compress_wide_node(const WideBVHNode &node, CompactWideBVHNode &compact)
+{
+    compact = CompactWideBVHNode();
+    Eigen::AlignedBox3f bounds;
+    for (int i = 0; i < bvh_width; i++)
+    {
+        if (node.bounds[0][i] > node.bounds[3][i])
+            continue; // unused slot
+        compact.valid |= 1 << i;
+        bounds.extend(Eigen::Vector3f(node.bounds[0][i], node.bounds[1][i], node.bounds[2][i]));
+        bounds.extend(Eigen::Vector3f(node.bounds[3][i], node.bounds[4][i], node.bounds[5][i]));
+        compact.child[i] = node.child[i];
+        compact.count[i] = node.count[i];
+    }
+    if (compact.valid == 0)
+        return;
+
+    for (int a = 0; a < 3; a++)
+    {
+        float origin = bounds.min()[a], extent = bounds.max()[a] - origin;
+
+        // The smallest power of two step whose 255 steps still reach the upper plane
+        int e = extent > 0.0f ? std::max((int)std::ceil(std::log2(extent / 255.0f)), -126) : -126;
+        while (e < 127 && origin + 255.0f * exp2_int(e) < bounds.max()[a])
+            e++;
+        float scale = exp2_int(e);
+        compact.origin[a] = origin;
+        compact.exponent[a] = e;
+
+        for (int i = 0; i < bvh_width; i++)
+        {
+            if (!(compact.valid & (1 << i)))
+                continue;
+            // Decoded exactly as in intersect_children(), and moved outwards until they contain the child
+            float lower = node.bounds[a][i], upper = node.bounds[a + 3][i];
+            int q_lower = std::min(std::max((int)std::floor((lower - origin) / scale), 0), 255);
+            int q_upper = std::min(std::max((int)std::ceil((upper - origin) / scale), 0), 255);
+            while (q_lower > 0 && origin + q_lower * scale > lower)
+                q_lower--;
+            while (q_upper < 255 && origin + q_upper * scale < upper)
+                q_upper++;
+            compact.bounds[a][i] = q_lower;
+            compact.bounds[a + 3][i] = q_upper;
+        }
+    }
+}
+
+void raytracer::compress_wide_bvh(const std::vector<WideBVHNode> &wide_nodes, std::vector<CompactWideBVHNode> &compact_nodes)
+{
+    compact_nodes.resize(wide_nodes.size());
+    ThreadPool::GetInstance()->parallel_for(0, wide_nodes.size(), 4096, [&](size_t i)
+                                            { compress_wide_node(wide_nodes[i], compact_nodes[i]); });
+}
+
+// Recomputes the bounds of the subtree rooted at node_index from the primitive bounds
+static void refit_node(std::vector<LinearBVHNode> &nodes, int node_index, const std::vector<Eigen::AlignedBox3f> &prim_bounds)
+{
+    LinearBVHNode &node = nodes[node_index];
+    if (node.n_primitives > 0)
+    {
+        Eigen::AlignedBox3f bounds;
+        for (int i = 0; i < node.n_primitives; i++)
+            bounds.extend(prim_bounds[node.primitives_offset + i]);
+        node.bounds = bounds;
+        return;
+    }
+
+    // The first child's subtree occupies the nodes up to the second child
+    if ((size_t)(node.second_child_offset - node_index) >= min_parallel_build_size)
+    {
+        ThreadPool *pool = ThreadPool::GetInstance();
+        auto first_done = pool->submit([&nodes, node_index, &prim_bounds]
+                                       { refit_node(nodes, node_index + 1, prim_bounds); });
+        refit_node(nodes, node.second_child_offset, prim_bounds);
+        pool->wait(first_done);
+    }
+    else
+    {
+        refit_node(nodes, node_index + 1, prim_bounds);
+        refit_node(nodes, node.second_child_offset, prim_bounds);
+    }
+
+    Eigen::AlignedBox3f bounds = nodes[node_index + 1].bounds;
+    bounds.extend(nodes[node.second_child_offset].bounds);
+    node.bounds = bounds;
+}
+
+void raytracer::refit_bvh(std::vector<LinearBVHNode> &nodes, const std::vector<Eigen::AlignedBox3f> &prim_bounds)
+{
+    if (nodes.empty())
+        return;
+    refit_node(nodes, 0, prim_bounds);
+}
+
+float raytracer::sah_cost(const std::vector<LinearBVHNode> &nodes, const BVHBuildParams &params)
+{
+    if (nodes.empty())
+        return 0.0f;
+    float root_area = surface_area(nodes[0].bounds);
+    if (root_area <= 0.0f)
+        return 0.0f;
+
+    float cost = 0.0f;
+    for (const auto &node : nodes)
+    {
+        if (node.n_primitives > 0)
+            cost += surface_area(node.bounds) * node.n_primitives * params.intersection_cost;
+        else
+            cost += surface_area(node.bounds) * params.traversal_cost;
+    }
+    return cost / root_area;
+}
+
+BVH::BVH(const std::vector<std::shared_ptr<GeometricObject>> &objects, const BVHBuildParams &params)
+{
+    this->params = params;
+    this->objects = objects;
+    build();
+}
+
+BVH::BVH(const std::vector<std::shared_ptr<GeometricObject>> &objects, const std::vector<LinearBVHNode> &nodes,
+         const std::vector<int> &references, const BVHBuildParams &params)
+{
+    this->params = params;
+    this->objects = objects;
+    this->nodes = nodes;
+    std::vector<PrimitiveRef> all = all_primitives();
+    primitives.resize(references.size());
+    for (size_t i = 0; i < references.size(); i++)
+        primitives[i] = all[references[i]];
+    build_cost = sah_cost(this->nodes, params);
+    collapse();
+    build_triangle_blocks();
+}
+
+int BVH::instance_depth() const
+{
+    int depth = 0;
+    for (const auto &object : objects)
+        depth = std::max(depth, object->instance_depth());
+    return depth;
+}
+
+std::vector<PrimitiveRef> BVH::all_primitives() const
+{
+    size_t count = 0;
+    for (const auto &object : objects)
+        count += object->primitive_count();
+
+    std::vector<PrimitiveRef> all;
+    all.reserve(count);
+    for (const auto &object : objects)
+    {
+        int n = object->primitive_count();
+        if (n == 1)
+            all.push_back({object.get(), -1});
+        else
+            for (int i = 0; i < n; i++)
+                all.push_back({object.get(), i});
+    }
+    return all;
+}
+
+void BVH::build()
+{
+    // ZoneScoped;
+    HiResTimer timer;
+    timer.start();
+
+    ThreadPool *pool = ThreadPool::GetInstance();
+    std::vector<PrimitiveRef> all = all_primitives();
+    std::vector<Eigen::AlignedBox3f> prim_bounds(all.size());
+    pool->parallel_for(0, all.size(), 4096, [&](size_t i)
+                       { prim_bounds[i] = all[i].bounding_box(); });
+
+    std::vector<int> ordered_prims;
+    nodes.clear();
+    build_bvh(prim_bounds, params, nodes, ordered_prims, [&all](int prim, const Eigen::AlignedBox3f &box)
+              { return all[prim].clipped_bounding_box(box); });
+
+    primitives.resize(ordered_prims.size());
+    pool->parallel_for(0, ordered_prims.size(), 16384, [&](size_t i)
+                       { primitives[i] = all[ordered_prims[i]]; });
+
+    build_cost = sah_cost(nodes, params);
+    collapse();
+    build_triangle_blocks();
+
+    timer.stop();
+    const char *method_names[] = {"SAH", "LBVH", "HLBVH", "SBVH"};
+    std::string tree = params.compact ? std::to_string(compact_nodes.size()) + " compact wide nodes"
+                                      : std::to_string(nodes.size()) + " nodes, " + std::to_string(wide_nodes.size()) + " wide nodes";
+    Console::GetInstance()->addSuccesEntry(std::string(method_names[params.method]) + " BVH over " + std::to_string(all.size()) + " primitives (" +
+                                           std::to_string(primitives.size()) + " references) built in " +
+                                           std::to_string(timer.elapsed_time_milliseconds()) + " ms (" + tree + ", " +
+                                           std::to_string(memory_usage() >> 10) + " KB)");
+}
+
+bool BVH::refit()
+{
+    // ZoneScoped;
+    // The leaves of a split BVH hold references clipped to the slabs of their splits, and the full
+    // primitive bounds a refit would give them overlap again. Rebuilding keeps the tree as good as built.
+    // A compact BVH freed its binary nodes, keeping them for a refit would take more than the compact tree itself.
+    if (params.method == SBVH || params.compact)
+    {
+        build();
+        return true;
+    }
+
+    HiResTimer timer;
+    timer.start();
+
+    ThreadPool *pool = ThreadPool::GetInstance();
+    std::vector<Eigen::AlignedBox3f> prim_bounds(primitives.size());
+    pool->parallel_for(0, primitives.size(), 4096, [&](size_t i)
+                       { prim_bounds[i] = primitives[i].bounding_box(); });
+
+    refit_bvh(nodes, prim_bounds);
+    float cost = sah_cost(nodes, params);
+    if (cost > build_cost * params.rebuild_threshold)
+    {
+        Console::GetInstance()->addWarningEntry("BVH quality degraded after refit (SAH cost " + std::to_string(build_cost) + " -> " +
+                                                std::to_string(cost) + "), rebuilding");
+        build();
+        return true;
+    }
+
+    // The collapse only looks at the binary tree, so redoing it is cheaper than tracking which binary node each wide slot came from
+    collapse();
+    build_triangle_blocks();
+
+    timer.stop();
+    Console::GetInstance()->addLogEntry("BVH refit in " + std::to_string(timer.elapsed_time_milliseconds()) + " ms (SAH cost " +
+                                        std::to_string(build_cost) + " -> " + std::to_string(cost) + ")");
+    return false;
+}
+
+void BVH::collapse()
+{
+    root_bounds = nodes.empty() ? Eigen::AlignedBox3f() : nodes[0].bounds;
+#if RT_BVH_WIDTH > 2
+    collapse_bvh(nodes, wide_nodes);
+    if (params.compact)
+    {
+        // Packets traverse the compact nodes too, so neither the full precision wide nor binary nodes are needed anymore
+        compress_wide_bvh(wide_nodes, compact_nodes);
+        wide_nodes.clear();
+        wide_nodes.shrink_to_fit();
+        nodes.clear();
+        nodes.shrink_to_fit();
+    }
+#endif
+}
+
+void BVH::build_triangle_blocks()
+{
+    // ZoneScoped;
+    triangle_blocks.clear();
+    leaf_blocks.assign(primitives.size(), -1);
+
+    // A leaf goes into blocks only if all its primitives are triangles, and visible to the
+    // camera since the blocks don't check that. The others keep calling find_hit().
+    // A compact BVH has none, the blocks would hold a full precision copy of every triangle.
+    if (params.compact)
+        return;
+    std::vector<const LinearBVHNode *> leaves;
+    int n_blocks = 0;
+    for (const LinearBVHNode &node : nodes)
+    {
+        if (node.n_primitives == 0)
+            continue;
+        bool all_triangles = true;
+        Eigen::Vector3f vertices[3];
+        for (int i = 0; i < node.n_primitives && all_triangles; i++)
+        {
+            const PrimitiveRef &prim = primitives[node.primitives_offset + i];
+            all_triangles = prim.object->visible_to_camera && prim.triangle_vertices(vertices);
+        }
+        if (!all_triangles)
+            continue;
+        leaves.push_back(&node);
+        leaf_blocks[node.primitives_offset] = n_blocks;
+        n_blocks += (node.n_primitives + triangle_block_width - 1) / triangle_block_width;
+    }
+
+    triangle_blocks.resize(n_blocks);
+    ThreadPool::GetInstance()->parallel_for(0, leaves.size(), 1024, [&](size_t l)
+                                            {
+        int offset = leaves[l]->primitives_offset;
+        TriangleBlock *blocks = &triangle_blocks[leaf_blocks[offset]];
+        Eigen::Vector3f vertices[3];
+        for (int i = 0; i < leaves[l]->n_primitives; i++)
+        {
+            primitives[offset + i].triangle_vertices(vertices);
+            blocks[i / triangle_block_width].set(i % triangle_block_width, offset + i, vertices);
+        } });
+}
+
+bool BVH::find_hit_leaf(int offset, int count, const Ray &r, const TriangleRay &tr, Interval &ray_t, PrimitiveHit &hit) const
+{
+    bool hit_anything = false;
+    int block = leaf_blocks[offset];
+    if (block >= 0)
+    {
+        TriangleHit closest;
+        for (int b = 0; b < count; b += triangle_block_width, block++)
+        {
+            if (closest_triangle_block_hit(triangle_blocks[block], tr, ray_t.min, ray_t.max, closest))
+            {
+                hit_anything = true;
+                ray_t.max = closest.t;
+            }
+        }
+        if (hit_anything)
+        {
+            const PrimitiveRef &prim = primitives[closest.prim];
+            hit.record(prim.object, closest.t, closest.beta, closest.gamma, prim.index < 0 ? 0 : prim.index);
+        }
+        return hit_anything;
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        if (primitives[offset + i].find_hit(r, ray_t, hit))
+        {
+            hit_anything = true;
+            ray_t.max = hit.t;
+        }
+    }
+    return hit_anything;
+}
+
+bool BVH::shadow_hit_leaf(int offset, int count, const Ray &r, const TriangleRay &tr, Interval ray_t) const
+{
+    int block = leaf_blocks[offset];
+    if (block >= 0)
+    {
+        float t[triangle_block_width], beta[triangle_block_width], gamma[triangle_block_width];
+        for (int b = 0; b < count; b += triangle_block_width, block++)
+        {
+            if (intersect_triangle_block(triangle_blocks[block], tr, ray_t.min, ray_t.max, t, beta, gamma) != 0)
+                return true;
+        }
+        return false;
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        if (primitives[offset + i].shadow_hit(r, ray_t))
+            return true;
+    }
+    return false;
+}
+
+bool BVH::find_hit(const Ray &r, Interval ray_t, PrimitiveHit &hit) const
+{
+    if (primitives.empty())
+        return false;
+
+    Eigen::Vector3f inv_dir = r.direction.cwiseInverse();
+#if RT_BVH_WIDTH > 2
+    if (params.compact)
+        return find_hit_wide(compact_nodes, r, inv_dir, ray_t, hit);
+    return find_hit_wide(wide_nodes, r, inv_dir, ray_t, hit);
+#else
+    return find_hit_binary(r, inv_dir, ray_t, hit);
+#endif
+}
+
+bool BVH::find_hit_binary(const Ray &r, const Eigen::Vector3f &inv_dir, Interval ray_t, PrimitiveHit &hit) const
+{
+    int dir_is_neg[3] = {inv_dir.x() < 0, inv_dir.y() < 0, inv_dir.z() < 0};
+
+    // Follow the ray through the tree, keeping the far children that still need to be visited on a stack
+    TriangleRay tr(r);
+    int to_visit[max_bvh_depth];
+    int to_visit_offset = 0;
+    int current = 0;
+    bool hit_anything = false;
+    while (true)
+    {
+        const LinearBVHNode &node = nodes[current];
+        if (hit_aabb(node.bounds, r.origin, inv_dir, dir_is_neg, ray_t))
+        {
+            if (node.n_primitives > 0)
+            {
+                hit_anything |= find_hit_leaf(node.primitives_offset, node.n_primitives, r, tr, ray_t, hit);
+                if (to_visit_offset == 0)
+                    break;
+                current = to_visit[--to_visit_offset];
+            }
+            else
+            {
+                // Visit the child nearer to the ray origin first, it is more likely to shorten the ray
+                if (dir_is_neg[node.axis])
+                {
+                    to_visit[to_visit_offset++] = current + 1;
+                    current = node.second_child_offset;
+                }
+                else
+                {
+                    to_visit[to_visit_offset++] = node.second_child_offset;
+                    current = current + 1;
+                }
+            }
+        }
+        else
+        {
+            if (to_visit_offset == 0)
+                break;
+            current = to_visit[--to_visit_offset];
+        }
+    }
+    return hit_anything;
+}
+
+#if RT_BVH_WIDTH > 2
+template <typename WideNode>
+bool BVH::find_hit_wide(const std::vector<WideNode> &tree, const Ray &r, const Eigen::Vector3f &inv_dir, Interval ray_t, PrimitiveHit &hit) const
+{
+    struct StackEntry
+    {
+        int child, count;
+        float t_entry;
+    };
+
+    WideRay wray(r.origin, inv_dir);
+    TriangleRay tr(r);
+    StackEntry stack[max_bvh_depth * (bvh_width - 1) + 1];
+    int stack_size = 0;
+    stack[stack_size++] = {0, 0, ray_t.min};
+    bool hit_anything = false;
+
+    while (stack_size > 0)
+    {
+        StackEntry entry = stack[--stack_size];
+
+        // The ray may have been shortened since this entry was pushed
+        if (entry.t_entry > ray_t.max)
+            continue;
+
+        if (entry.count > 0)
+        {
+            hit_anything |= find_hit_leaf(entry.child, entry.count, r, tr, ray_t, hit);
+            continue;
+        }
+
+        const WideNode &node = tree[entry.child];
+        float t_entry[bvh_width];
+        int mask = intersect_children(node, wray, ray_t.min, ray_t.max, t_entry);
+
+        // Push the children that were hit so that the nearest one ends up on top of the stack
+        int first = stack_size;
+        while (mask != 0)
+        {
+            int i = __builtin_ctz(mask);
+            mask &= mask - 1;
+
+            StackEntry child_entry = {node.child[i], node.count[i], t_entry[i]};
+            int j = stack_size++;
+            while (j > first && stack[j - 1].t_entry < child_entry.t_entry)
+            {
+                stack[j] = stack[j - 1];
+                j--;
+            }
+            stack[j] = child_entry;
+        }
+    }
+    return hit_anything;
+}
+
+template <typename WideNode>
+bool BVH::shadow_hit_wide(const std::vector<WideNode> &tree, const Ray &r, const Eigen::Vector3f &inv_dir, Interval ray_t) const
+{
+    // Any hit will do, so the children are visited in whatever order they come in
+    TriangleRay tr(r);
+    WideRay wray(r.origin, inv_dir);
+    int stack[max_bvh_depth * (bvh_width - 1) + 1];
+    int stack_size = 0;
+    stack[stack_size++] = 0;
+
+    while (stack_size > 0)
+    {
+        const WideNode &node = tree[stack[--stack_size]];
+        float t_entry[bvh_width];
+        int mask = intersect_children(node, wray, ray_t.min, ray_t.max, t_entry);
+        while (mask != 0)
+        {
+            int i = __builtin_ctz(mask);
+            mask &= mask - 1;
+
+            if (node.count[i] == 0)
+            {
+                stack[stack_size++] = node.child[i];
+                continue;
+            }
+            if (shadow_hit_leaf(node.child[i], node.count[i], r, tr, ray_t))
+                return true;
+        }
+    }
+    return false;
+}
+#endif
+
+bool BVH::shadow_hit(const Ray &r, Interval ray_t) const
+{
+    if (primitives.empty())
+        return false;
+
+    Eigen::Vector3f inv_dir = r.direction.cwiseInverse();
+#if RT_BVH_WIDTH > 2
+    if (params.compact)
+        return shadow_hit_wide(compact_nodes, r, inv_dir, ray_t);
+    return shadow_hit_wide(wide_nodes, r, inv_dir, ray_t);
+#else
+    TriangleRay tr(r);
+    int dir_is_neg[3] = {inv_dir.x() < 0, inv_dir.y() < 0, inv_dir.z() < 0};
+    int to_visit[max_bvh_depth];
+    int to_visit_offset = 0;
+    int current = 0;
+    while (true)
+    {
+        const LinearBVHNode &node = nodes[current];
+        if (hit_aabb(node.bounds, r.origin, inv_dir, dir_is_neg, ray_t))
+        {
+            if (node.n_primitives > 0)
+            {
+                if (shadow_hit_leaf(node.primitives_offset, node.n_primitives, r, tr, ray_t))
+                    return true;
+            }
+            else
+            {
+                to_visit[to_visit_offset++] = node.second_child_offset;
+                current = current + 1;
+                continue;
+            }
+        }
+        if (to_visit_offset == 0)
+            break;
+        current = to_visit[--to_visit_offset];
+    }
+    return false;
+#endif
+}
+
+int PrimitiveRef::find_hit_packet(RayPacket &packet, PrimitiveHit *hits, int active) const
+{
+    if (index < 0)
+        return object->find_hit_packet(packet, hits, active);
+
+    int hit_mask = 0;
+    for (int lanes = active; lanes != 0; lanes &= lanes - 1)
+    {
+        int l = __builtin_ctz(lanes);
+        if (object->find_primitive_hit(index, packet.rays[l], Interval(packet.t_min, packet.t_max[l]), hits[l]))
+        {
+            packet.t_max[l] = hits[l].t;
+            hit_mask |= 1 << l;
+        }
+    }
+    return hit_mask;
+}
+
+int PrimitiveRef::shadow_hit_packet(const RayPacket &packet, int active) const
+{
+    if (index < 0)
+        return object->shadow_hit_packet(packet, active);
+
+    int hit_mask = 0;
+    for (int lanes = active; lanes != 0; lanes &= lanes - 1)
+    {
+        int l = __builtin_ctz(lanes);
+        if (object->shadow_hit_primitive(index, packet.rays[l], Interval(packet.t_min, packet.t_max[l])))
+            hit_mask |= 1 << l;
+    }
+    return hit_mask;
+}
+
+int BVH::find_hit_packet_leaf(int offset, int count, RayPacket &packet, PrimitiveHit *hits, int mask) const
+{
+    int hit_mask = 0;
+    if (leaf_blocks[offset] >= 0)
+    {
+        // The blocks test one ray against several triangles, so they are run lane by lane
+        for (int lanes = mask; lanes != 0; lanes &= lanes - 1)
+        {
+            int l = __builtin_ctz(lanes);
+            Interval ray_t(packet.t_min, packet.t_max[l]);
+            if (find_hit_leaf(offset, count, packet.rays[l], TriangleRay(packet.rays[l]), ray_t, hits[l]))
+            {
+                packet.t_max[l] = ray_t.max;
+                hit_mask |= 1 << l;
+            }
+        }
+        return hit_mask;
+    }
+
+    for (int i = 0; i < count; i++)
+        hit_mask |= primitives[offset + i].find_hit_packet(packet, hits, mask);
+    return hit_mask;
+}
+
+int BVH::shadow_hit_packet_leaf(int offset, int count, const RayPacket &packet, int mask) const
+{
+    // A lane is done as soon as anything blocks it
+    int hit_mask = 0;
+    if (leaf_blocks[offset] >= 0)
+    {
+        for (int lanes = mask; lanes != 0; lanes &= lanes - 1)
+        {
+            int l = __builtin_ctz(lanes);
+            if (shadow_hit_leaf(offset, count, packet.rays[l], TriangleRay(packet.rays[l]), Interval(packet.t_min, packet.t_max[l])))
+                hit_mask |= 1 << l;
+        }
+        return hit_mask;
+    }
+
+    for (int i = 0; i < count && mask != 0; i++)
+    {
+        int blocked = primitives[offset + i].shadow_hit_packet(packet, mask);
+        hit_mask |= blocked;
+        mask &= ~blocked;
+    }
+    return hit_mask;
+}
+
+// Packets are traced through the binary tree: its nodes hold a single box, which is tested against all the rays at once
+int BVH::find_hit_packet(RayPacket &packet, PrimitiveHit *hits, int active) const
+{
+    if (primitives.empty() || active == 0)
+        return 0;
+#if RT_BVH_WIDTH > 2
+    if (params.compact)
+        return find_hit_packet_compact(packet, hits, active);
+#endif
+
+    // The rays are coherent, so the child order that suits the first one suits them all
+    int first = __builtin_ctz(active);
+    int dir_is_neg[3] = {packet.inv_dir[0][first] < 0, packet.inv_dir[1][first] < 0, packet.inv_dir[2][first] < 0};
+
+    int to_visit[max_bvh_depth];
+    int to_visit_offset = 0;
+    int current = 0;
+    int hit_mask = 0;
+    while (true)
+    {
+        const LinearBVHNode &node = nodes[current];
+        int mask = intersect_packet(node.bounds, packet, active);
+        if (mask != 0)
+        {
+            if (node.n_primitives > 0)
+            {
+                hit_mask |= find_hit_packet_leaf(node.primitives_offset, node.n_primitives, packet, hits, mask);
+                if (to_visit_offset == 0)
+                    break;
+                current = to_visit[--to_visit_offset];
+            }
+            else if (dir_is_neg[node.axis])
+            {
+                to_visit[to_visit_offset++] = current + 1;
+                current = node.second_child_offset;
+            }
+            else
+            {
+                to_visit[to_visit_offset++] = node.second_child_offset;
+                current = current + 1;
+            }
+        }
+        else
+        {
+            if (to_visit_offset == 0)
+                break;
+            current = to_visit[--to_visit_offset];
+        }
+    }
+    return hit_mask;
+}
+
+int BVH::shadow_hit_packet(const RayPacket &packet, int active) const
+{
+    if (primitives.empty())
+        return 0;
+#if RT_BVH_WIDTH > 2
+    if (params.compact)
+        return shadow_hit_packet_compact(packet, active);
+#endif
+
+    int to_visit[max_bvh_depth];
+    int to_visit_offset = 0;
+    int current = 0;
+    int hit_mask = 0;
+    while (active != 0)
+    {
+        const LinearBVHNode &node = nodes[current];
+        int mask = intersect_packet(node.bounds, packet, active);
+        if (mask != 0)
+        {
+            if (node.n_primitives == 0)
+            {
+                to_visit[to_visit_offset++] = node.second_child_offset;
+                current = current + 1;
+                continue;
+            }
+            int blocked = shadow_hit_packet_leaf(node.primitives_offset, node.n_primitives, packet, mask);
+            hit_mask |= blocked;
+            active &= ~blocked;
+        }
+        if (to_visit_offset == 0)
+            break;
+        current = to_visit[--to_visit_offset];
+    }
+    return hit_mask;
+}
+
+#if RT_BVH_WIDTH > 2
+// A compact BVH keeps no binary tree, so its packets go through the wide nodes, testing every child box against all the rays
+int BVH::find_hit_packet_compact(RayPacket &packet, PrimitiveHit *hits, int active) const
+{
+    struct StackEntry
+    {
+        int child, count, mask;
+        float distance;
+    };
+
+    // The rays are coherent, so the children are visited in the order that suits the first one
+    int first = __builtin_ctz(active);
+    const Ray &first_ray = packet.rays[first];
+
+    StackEntry stack[max_bvh_depth * (bvh_width - 1) + 1];
+    int stack_size = 0;
+    stack[stack_size++] = {0, 0, active, 0.0f};
+    int hit_mask = 0;
+    while (stack_size > 0)
+    {
+        StackEntry entry = stack[--stack_size];
+        if (entry.count > 0)
+        {
+            hit_mask |= find_hit_packet_leaf(entry.child, entry.count, packet, hits, entry.mask);
+            continue;
+        }
+
+        // The lanes shortened since this entry was pushed drop out here, the child tests use their current t_max
+        const CompactWideBVHNode &node = compact_nodes[entry.child];
+        int masks[bvh_width];
+        int hit_children = intersect_children_packet(node, packet, entry.mask, masks);
+
+        // Push the children that were hit so that the nearest one, by the distance of its center along the first ray, ends up on top
+        int first_child = stack_size;
+        while (hit_children != 0)
+        {
+            int i = __builtin_ctz(hit_children);
+            hit_children &= hit_children - 1;
+
+            Eigen::Vector3f center;
+            for (int a = 0; a < 3; a++)
+                center[a] = node.origin[a] + 0.5f * (node.bounds[a][i] + node.bounds[a + 3][i]) * exp2_int(node.exponent[a]);
+            StackEntry child_entry = {node.child[i], node.count[i], masks[i], (center - first_ray.origin).dot(first_ray.direction)};
+            int j = stack_size++;
+            while (j > first_child && stack[j - 1].distance < child_entry.distance)
+            {
+                stack[j] = stack[j - 1];
+                j--;
+            }
+            stack[j] = child_entry;
+        }
+    }
+    return hit_mask;
+}
+
+int BVH::shadow_hit_packet_compact(const RayPacket &packet, int active) const
+{
+    // Any hit will do, so the children are visited in whatever order they come in
+    struct StackEntry
+    {
+        int child, count, mask;
+    };
+
+    StackEntry stack[max_bvh_depth * (bvh_width - 1) + 1];
+    int stack_size = 0;
+    stack[stack_size++] = {0, 0, active};
+    int hit_mask = 0;
+    while (stack_size > 0 && active != 0)
+    {
+        StackEntry entry = stack[--stack_size];
+        int mask = entry.mask & active;
+        if (mask == 0)
+            continue;
+        if (entry.count > 0)
+        {
+            int blocked = shadow_hit_packet_leaf(entry.child, entry.count, packet, mask);
+            hit_mask |= blocked;
+            active &= ~blocked;
+            continue;
+        }
+
+        const CompactWideBVHNode &node = compact_nodes[entry.child];
+        int masks[bvh_width];
+        for (int hit_children = intersect_children_packet(node, packet, mask, masks); hit_children != 0; hit_children &= hit_children - 1)
+        {
+            int i = __builtin_ctz(hit_children);
+            stack[stack_size++] = {node.child[i], node.count[i], masks[i]};
+        }
+    }
+    return hit_mask;
+}
+#endif
+
+size_t BVH::memory_usage() const
+{
+    return sizeof(BVH) + objects.size() * sizeof(objects[0]) + primitives.size() * sizeof(PrimitiveRef) +
+           nodes.size() * sizeof(LinearBVHNode) + wide_nodes.size() * sizeof(WideBVHNode) +
+           compact_nodes.size() * sizeof(CompactWideBVHNode) + triangle_blocks.size() * sizeof(TriangleBlock) +
+           leaf_blocks.size() * sizeof(int);
+}
+
+Eigen::AlignedBox3f BVH::bounding_box() const
+{
+    return root_bounds;
+}
\ No newline at end of file
@@ -1,121 +1,257 @@
 #pragma once
 #include <memory>
-#include <algorithm>
+#include <vector>
+#include <cstdint>
+#include <functional>
 #include "geometric_object.h"
-#include "world.h"
+#include "wide_bvh.h"
+#include "triangle_block.h"
 #include "utilities.h"
 
-static bool hit_aabb(raytracer::Ray r, raytracer::Interval ray_t, Eigen::AlignedBox3f aabb)
+namespace raytracer
 {
-    for (int a = 0; a < 3; a++)
+    /*
+     *  SAH gives the best trees and is meant for static geometry. LBVH sorts the primitives
+     *  along a Morton curve and emits the hierarchy straight from the bits of their codes,
+     *  which is an order of magnitude faster to build but gives worse trees. HLBVH builds
+     *  the bottom of the tree the same way and the top levels with SAH (see 4.3.3 in pbrt).
+     *  SBVH is SAH that may also split primitives between nodes, for scenes with long, thin triangles.
+     */
+    enum BVHBuildMethod
     {
-        float invD = 1 / r.direction[a];
-        float orig = r.origin[a];
+        SAH,
+        LBVH,
+        HLBVH,
+        SBVH
+    };
 
-        float t0 = (aabb.min()[a] - orig) * invD;
-        float t1 = (aabb.max()[a] - orig) * invD;
+    /*
+     *  Parameters of the Surface Area Heuristic used when building the BVH.
+     *  The costs are relative: only their ratio matters when comparing a split
+     *  against turning the node into a leaf (see 4.3.2 in pbrt).
+     */
+    struct BVHBuildParams
+    {
+        BVHBuildMethod method = SAH;
+        int max_leaf_size = 4;          // nodes with more primitives than this are always split
+        int num_bins = 12;              // number of centroid buckets evaluated per node
+        float traversal_cost = 0.125f;  // cost of visiting an interior node (ray-box test)
+        float intersection_cost = 1.0f; // cost of a single ray-primitive test
+        int morton_bits = 30;           // LBVH/HLBVH: 30 (10 per axis) or 63 (21 per axis) bit Morton codes
+        float rebuild_threshold = 1.5f; // refit: rebuild from scratch once the SAH cost grew by this factor
+        float spatial_split_alpha = 1e-5f; // SBVH: try spatial splits where the children overlap by more than this fraction of the root area
+        float max_duplication = 0.3f;      // SBVH: at most this many extra references per primitive, on average
+        bool compact = false;              // only quantized wide nodes and no triangle blocks, for scenes that barely fit in memory
+    };
 
-        if (invD < 0)
-            std::swap(t0, t1);
+    /*
+     *  A node of the flattened BVH. The nodes are stored in depth-first order,
+     *  so the first child of an interior node is always the next node in the array
+     *  and only the offset of the second child has to be stored.
+     */
+    struct LinearBVHNode
+    {
+        Eigen::AlignedBox3f bounds;
+        union
+        {
+            int primitives_offset;   // leaf
+            int second_child_offset; // interior
+        };
+        uint16_t n_primitives; // 0 -> interior node
+        uint8_t axis;          // interior node: the axis the children were split on
+        uint8_t pad;           // ensure 32 byte total size
+    };
+    static_assert(sizeof(LinearBVHNode) == 32, "LinearBVHNode should be 32 bytes");
 
-        if (t0 > ray_t.min)
-            ray_t.min = t0;
-        if (t1 < ray_t.max)
-            ray_t.max = t1;
+    // Size of the traversal stack. The builder falls back to median splits deep in the tree so it is never exceeded.
+    const int max_bvh_depth = 128;
 
-        if (ray_t.max <= ray_t.min)
-            return false;
+    inline float surface_area(const Eigen::AlignedBox3f &box)
+    {
+        if (box.isEmpty())
+            return 0.0f;
+        Eigen::Vector3f d = box.sizes();
+        return 2.0f * (d.x() * d.y() + d.y() * d.z() + d.z() * d.x());
     }
-    return true;
-}
 
-namespace raytracer
-{
-    class BVH_Node : public GeometricObject
+    /*
+     *  Slab test of a ray against a box, using the precomputed reciprocal of the ray direction.
+     */
+    inline bool hit_aabb(const Eigen::AlignedBox3f &aabb, const Eigen::Vector3f &origin, const Eigen::Vector3f &inv_dir, const int dir_is_neg[3], Interval ray_t)
     {
-    public:
-        BVH_Node(const std::vector<std::shared_ptr<GeometricObject>> &objects) : BVH_Node(objects, 0, objects.size()) {}
-
-        BVH_Node(const std::vector<std::shared_ptr<GeometricObject>> &src_objects, size_t start, size_t end)
+        for (int a = 0; a < 3; a++)
         {
-            // ZoneScoped;
-            auto objects = src_objects; // Create a modifiable array of the source scene objects
-
-            int axis = random_int(0, 2);
-            auto comparator = (axis == 0)   ? box_x_compare
-                              : (axis == 1) ? box_y_compare
-                                            : box_z_compare;
-
-            size_t object_span = end - start;
-
-            if (object_span == 1)
-            {
-                left = right = objects[start];
-            }
-            else if (object_span == 2)
-            {
-                if (comparator(objects[start], objects[start + 1]))
-                {
-                    left = objects[start];
-                    right = objects[start + 1];
-                }
-                else
-                {
-                    left = objects[start + 1];
-                    right = objects[start];
-                }
-            }
-            else
-            {
-                // std::sort(objects.begin() + start, objects.begin() + end, comparator);
-                auto mid = start + object_span / 2;
-                std::nth_element(objects.begin() + start, objects.begin() + object_span / 2, objects.begin() + end, comparator);
-
-                left = std::make_shared<BVH_Node>(objects, start, mid);
-                right = std::make_shared<BVH_Node>(objects, mid, end);
-            }
-            
-            aabb.extend(left->bounding_box());
-            aabb.extend(right->bounding_box());
-        }
+            float t0 = ((dir_is_neg[a] ? aabb.max() : aabb.min())[a] - origin[a]) * inv_dir[a];
+            float t1 = ((dir_is_neg[a] ? aabb.min() : aabb.max())[a] - origin[a]) * inv_dir[a];
 
-        bool hit(const Ray &r, Interval ray_t, HitInfo &rec) const override
-        {
-            if (!hit_aabb(r, ray_t, aabb))
+            if (t0 > ray_t.min)
+                ray_t.min = t0;
+            if (t1 < ray_t.max)
+                ray_t.max = t1;
+
+            if (ray_t.max <= ray_t.min)
                 return false;
+        }
+        return true;
+    }
+
+    // Returns the bounds of the part of primitive prim that lies inside box
+    typedef std::function<Eigen::AlignedBox3f(int prim, const Eigen::AlignedBox3f &box)> PrimitiveClipper;
+
+    /*
+     *  Builds a BVH over a set of primitives given only by their bounding boxes.
+     *  On return, nodes holds the flattened tree and ordered_prims the primitive indices
+     *  in the order the leaves reference them: a leaf covers the primitives
+     *  ordered_prims[primitives_offset, primitives_offset + n_primitives).
+     *  The SBVH method may reference a primitive from several leaves and uses clip to
+     *  split its bounds; without it, the bounding boxes themselves are clipped.
+     */
+    void build_bvh(const std::vector<Eigen::AlignedBox3f> &prim_bounds, const BVHBuildParams &params,
+                   std::vector<LinearBVHNode> &nodes, std::vector<int> &ordered_prims, const PrimitiveClipper &clip = nullptr);
 
-            bool hit_left = left->hit(r, ray_t, rec);
-            bool hit_right = right->hit(r, Interval(ray_t.min, hit_left ? rec.t : ray_t.max), rec);
+    // The spatial split builder used by build_bvh for the SBVH method, see sbvh.cpp
+    void build_sbvh(const std::vector<Eigen::AlignedBox3f> &prim_bounds, const PrimitiveClipper &clip, const BVHBuildParams &params,
+                    std::vector<LinearBVHNode> &nodes, std::vector<int> &ordered_prims);
+
+    /*
+     *  Collapses a binary BVH into nodes with up to bvh_width children, by repeatedly
+     *  pulling up the grandchildren of the child with the largest surface area. The leaves
+     *  keep referencing the same primitive ranges, so the primitive order is unchanged.
+     */
+    void collapse_bvh(const std::vector<LinearBVHNode> &nodes, std::vector<WideBVHNode> &wide_nodes);
+
+    // Quantizes the child boxes of every wide node, keeping the same node indices
+    void compress_wide_bvh(const std::vector<WideBVHNode> &wide_nodes, std::vector<CompactWideBVHNode> &compact_nodes);
+
+    /*
+     *  Recomputes the node bounds bottom-up after the primitives moved, keeping the topology.
+     *  prim_bounds is indexed like the leaves, i.e. in the order of ordered_prims.
+     */
+    void refit_bvh(std::vector<LinearBVHNode> &nodes, const std::vector<Eigen::AlignedBox3f> &prim_bounds);
+
+    // Expected cost of tracing a random ray through the tree, relative to the area of the root
+    float sah_cost(const std::vector<LinearBVHNode> &nodes, const BVHBuildParams &params);
+
+    /*
+     *  A primitive as the BVH sees it: a whole object, or one of the primitives of an object
+     *  made of many, like a TriangleMesh (see GeometricObject::primitive_count()).
+     */
+    struct PrimitiveRef
+    {
+        const GeometricObject *object;
+        int index; // -1 if the object is a single primitive, which skips the indexed calls
 
-            return hit_left || hit_right;
+        Eigen::AlignedBox3f bounding_box() const
+        {
+            return index < 0 ? object->bounding_box() : object->primitive_bounding_box(index);
         }
 
-        static bool box_compare(
-            const std::shared_ptr<GeometricObject> a, const std::shared_ptr<GeometricObject> b, int axis_index)
+        Eigen::AlignedBox3f clipped_bounding_box(const Eigen::AlignedBox3f &box) const
         {
-            return a->bounding_box().min()[axis_index] < b->bounding_box().min()[axis_index];
+            return index < 0 ? object->clipped_bounding_box(box) : object->clipped_primitive_bounding_box(index, box);
         }
 
-        static bool box_x_compare(const std::shared_ptr<GeometricObject> a, const std::shared_ptr<GeometricObject> b)
+        bool find_hit(const Ray &r, Interval ray_t, PrimitiveHit &hit) const
         {
-            return box_compare(a, b, 0);
+            return index < 0 ? object->find_hit(r, ray_t, hit) : object->find_primitive_hit(index, r, ray_t, hit);
         }
 
-        static bool box_y_compare(const std::shared_ptr<GeometricObject> a, const std::shared_ptr<GeometricObject> b)
+        bool shadow_hit(const Ray &r, Interval ray_t) const
         {
-            return box_compare(a, b, 1);
+            return index < 0 ? object->shadow_hit(r, ray_t) : object->shadow_hit_primitive(index, r, ray_t);
         }
 
-        static bool box_z_compare(const std::shared_ptr<GeometricObject> a, const std::shared_ptr<GeometricObject> b)
+        bool triangle_vertices(Eigen::Vector3f vertices[3]) const
         {
-            return box_compare(a, b, 2);
+            return object->triangle_vertices(index < 0 ? 0 : index, vertices);
         }
 
-        Eigen::AlignedBox3f bounding_box() const override { return aabb; }
+        // The packet versions only exist for whole objects, the primitives of the others are traced lane by lane
+        int find_hit_packet(RayPacket &packet, PrimitiveHit *hits, int active) const;
+        int shadow_hit_packet(const RayPacket &packet, int active) const;
+    };
+
+    class BVH : public GeometricObject
+    {
+    public:
+        BVH(const std::vector<std::shared_ptr<GeometricObject>> &objects, const BVHBuildParams &params = BVHBuildParams());
+
+        /*
+         *  Wraps a tree built earlier (e.g. by the BVH cache) with build_bvh(). references are the
+         *  ordered_prims it returned, indexing the primitives of objects in order: all those of
+         *  objects[0] (primitive_count() of them), then those of objects[1], and so on.
+         */
+        BVH(const std::vector<std::shared_ptr<GeometricObject>> &objects, const std::vector<LinearBVHNode> &nodes,
+            const std::vector<int> &references, const BVHBuildParams &params);
+
+        bool find_hit(const Ray &r, Interval ray_t, PrimitiveHit &hit) const override;
+
+        bool shadow_hit(const Ray &r, Interval ray_t) const override;
+
+        int find_hit_packet(RayPacket &packet, PrimitiveHit *hits, int active) const override;
+
+        int shadow_hit_packet(const RayPacket &packet, int active) const override;
+
+        Eigen::AlignedBox3f bounding_box() const override;
+
+        int instance_depth() const override;
+
+        // The nodes of the binary tree, which a compact BVH doesn't keep once collapsed
+        size_t node_count() const { return nodes.size(); }
+
+        // Bytes taken by the tree and its triangle blocks, not counting the primitives themselves
+        size_t memory_usage() const;
+
+        /*
+         *  Updates the tree after the primitives changed shape or position (e.g. the vertices of
+         *  an animated mesh were modified), without changing which primitives the leaves hold.
+         *  Falls back to a full rebuild when the refitted tree got too slow to trace, and
+         *  returns true in that case. An SBVH is always rebuilt, as its spatially split
+         *  references can't keep their clipped bounds, and so is a compact BVH, which has no
+         *  binary tree left to refit. Must not be called while the BVH is being traced.
+         */
+        bool refit();
 
     private:
-        std::shared_ptr<GeometricObject> left;
-        std::shared_ptr<GeometricObject> right;
-        Eigen::AlignedBox3f aabb;
+        std::vector<std::shared_ptr<GeometricObject>> objects; // owns the primitives, traversal only uses the raw pointers below
+        std::vector<PrimitiveRef> primitives;                  // reordered so that every leaf is a contiguous range
+        std::vector<LinearBVHNode> nodes;    // traversed by packets and without SIMD, freed after the collapse with params.compact
+        std::vector<WideBVHNode> wide_nodes; // the nodes actually traversed by single rays when SIMD is available
+        std::vector<CompactWideBVHNode> compact_nodes; // with params.compact, the only tree kept, traversed by single rays and packets alike
+        Eigen::AlignedBox3f root_bounds;
+        std::vector<TriangleBlock> triangle_blocks; // the triangles of the leaves holding nothing else
+        std::vector<int> leaf_blocks;                // first block of the leaf starting at each primitive offset, -1 for the leaves tested with find_hit()
+        BVHBuildParams params;
+        float build_cost = 0.0f; // SAH cost of the tree right after it was built, the baseline for refits
+
+        void build();
+
+        // Builds the wide nodes traversed by single rays from the binary ones
+        void collapse();
+
+        // Every primitive of the objects, in the order build_bvh() indexes them
+        std::vector<PrimitiveRef> all_primitives() const;
+
+        // Copies the triangles of the leaves into SIMD blocks, after the tree or the primitives changed
+        void build_triangle_blocks();
+
+        // Intersects the primitives of a leaf, shortening ray_t to the closest hit
+        bool find_hit_leaf(int offset, int count, const Ray &r, const TriangleRay &tr, Interval &ray_t, PrimitiveHit &hit) const;
+        bool shadow_hit_leaf(int offset, int count, const Ray &r, const TriangleRay &tr, Interval ray_t) const;
+
+        // The same for the lanes in mask of a packet, returning the mask of those that hit
+        int find_hit_packet_leaf(int offset, int count, RayPacket &packet, PrimitiveHit *hits, int mask) const;
+        int shadow_hit_packet_leaf(int offset, int count, const RayPacket &packet, int mask) const;
+
+        bool find_hit_binary(const Ray &r, const Eigen::Vector3f &inv_dir, Interval ray_t, PrimitiveHit &hit) const;
+
+        // WideNode is WideBVHNode or CompactWideBVHNode
+        template <typename WideNode>
+        bool find_hit_wide(const std::vector<WideNode> &tree, const Ray &r, const Eigen::Vector3f &inv_dir, Interval ray_t, PrimitiveHit &hit) const;
+        template <typename WideNode>
+        bool shadow_hit_wide(const std::vector<WideNode> &tree, const Ray &r, const Eigen::Vector3f &inv_dir, Interval ray_t) const;
+
+        int find_hit_packet_compact(RayPacket &packet, PrimitiveHit *hits, int active) const;
+        int shadow_hit_packet_compact(const RayPacket &packet, int active) const;
     };
 }
\ No newline at end of file
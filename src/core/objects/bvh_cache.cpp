@@ -0,0 +1,364 @@
+#include <cstdio>
+#include <cstring>
+#include <climits>
+#include <cstdint>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <direct.h>
+#endif
+
+#include "bvh_cache.h"
+#include "mapped_file.h"
+#include "obj_loader.h"
+#include "clock_util.h"
+#include "console.h"
+using namespace raytracer;
+
+// Bump whenever the layout of the cache file or of anything stored in it changes
+static const uint32_t bvh_cache_version = 3;
+
+// The cache file is this header followed by the arrays it describes, in the order of MeshBVHLayout
+struct BVHCacheHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t node_size; // sizeof(LinearBVHNode) of the writer
+    uint64_t key;
+    uint64_t nr_vertices;
+    uint64_t nr_triangles;
+    uint64_t nr_nodes;
+    uint64_t nr_references;
+    uint32_t has_normals;
+    uint32_t shading_type;
+    uint32_t has_uvs;
+    uint32_t indexed_normals; // normals from the file, with an index per corner
+    uint64_t nr_normals;
+    uint64_t nr_uvs;
+};
+
+static const char bvh_cache_magic[8] = {'R', 'T', 'B', 'V', 'H', 'C', 'A', 'C'};
+
+uint64_t raytracer::hash_bytes(const void *data, size_t size, uint64_t hash)
+{
+    const unsigned char *bytes = static_cast<const unsigned char *>(data);
+    for (size_t i = 0; i < size; i++)
+    {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+template <typename T>
+static uint64_t hash_value(const T &value, uint64_t hash)
+{
+    return hash_bytes(&value, sizeof(T), hash);
+}
+
+static uint64_t cache_key(const MappedFile &obj_file, int shape_index, ShadingType shading_type, const BVHBuildParams &params)
+{
+    uint64_t key = hash_bytes(obj_file.data(), obj_file.size());
+    key = hash_value(bvh_cache_version, key);
+    key = hash_value(shape_index, key);
+    key = hash_value((int)shading_type, key);
+    key = hash_value((int)params.method, key);
+    key = hash_value(params.max_leaf_size, key);
+    key = hash_value(params.num_bins, key);
+    key = hash_value(params.traversal_cost, key);
+    key = hash_value(params.intersection_cost, key);
+    key = hash_value(params.morton_bits, key);
+    key = hash_value(params.spatial_split_alpha, key);
+    key = hash_value(params.max_duplication, key);
+    return key;
+}
+
+static std::string cache_path(const std::string &cache_dir, uint64_t key)
+{
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.bvh", (unsigned long long)key);
+    return cache_dir + "/" + name;
+}
+
+static MeshBVHLayout cache_layout(const BVHCacheHeader &h)
+{
+    MeshBVHLayout layout;
+    layout.nr_vertices = h.nr_vertices;
+    layout.nr_triangles = h.nr_triangles;
+    layout.nr_normals = h.nr_normals;
+    layout.nr_uvs = h.nr_uvs;
+    layout.nr_nodes = h.nr_nodes;
+    layout.nr_references = h.nr_references;
+    layout.has_normals = h.has_normals != 0;
+    layout.indexed_normals = h.indexed_normals != 0;
+    layout.has_uvs = h.has_uvs != 0;
+    return layout;
+}
+
+bool raytracer::write_file_atomically(const std::string &path, const std::function<bool(FILE *)> &write)
+{
+    std::string temp_path = path + ".tmp";
+    FILE *f = fopen(temp_path.c_str(), "wb");
+    if (f == nullptr)
+        return false;
+
+    bool ok = write(f);
+    ok = (fclose(f) == 0) && ok;
+    if (ok)
+    {
+        remove(path.c_str());
+        ok = rename(temp_path.c_str(), path.c_str()) == 0;
+    }
+    if (!ok)
+        remove(temp_path.c_str());
+    return ok;
+}
+
+MeshBVHLayout::MeshBVHLayout(const Mesh &mesh, const std::vector<LinearBVHNode> &nodes, const std::vector<int> &references)
+    : nr_vertices(mesh.nr_vertices), nr_triangles(mesh.nr_triangles), nr_normals(mesh.nr_normals), nr_uvs(mesh.nr_uvs),
+      nr_nodes(nodes.size()), nr_references(references.size()),
+      has_normals(mesh.has_normals), indexed_normals(!mesh.normal_idx.empty()), has_uvs(mesh.has_uvs)
+{
+}
+
+bool MeshBVHLayout::fits() const
+{
+    const uint64_t max_count = INT_MAX;
+    return nr_vertices <= max_count && nr_triangles <= max_count / 3 && nr_normals <= max_count && nr_uvs <= max_count &&
+           nr_nodes <= max_count && nr_references <= max_count;
+}
+
+size_t MeshBVHLayout::payload_size() const
+{
+    // With every count below 2^31, none of the products or their sum can wrap
+    if (!fits())
+        return SIZE_MAX;
+    size_t corners = nr_triangles * 3 * sizeof(int);
+    return nr_vertices * sizeof(Eigen::Vector3f) + corners +
+           (has_normals ? nr_normals * sizeof(Eigen::Vector3f) + (indexed_normals ? corners : 0) : 0) +
+           (has_uvs ? nr_uvs * sizeof(Eigen::Vector2f) + corners : 0) +
+           nr_nodes * sizeof(LinearBVHNode) + nr_references * sizeof(int);
+}
+
+bool raytracer::write_mesh_bvh(const Mesh &mesh, const std::vector<LinearBVHNode> &nodes, const std::vector<int> &references,
+                               const std::function<bool(const void *, size_t)> &write)
+{
+    bool ok = write(mesh.vertices.get(), mesh.nr_vertices * sizeof(Eigen::Vector3f));
+    ok = ok && write(mesh.vertex_idx.data(), mesh.vertex_idx.size() * sizeof(int));
+    if (mesh.has_normals)
+    {
+        ok = ok && write(mesh.normals.get(), mesh.nr_normals * sizeof(Eigen::Vector3f));
+        ok = ok && write(mesh.normal_idx.data(), mesh.normal_idx.size() * sizeof(int));
+    }
+    if (mesh.has_uvs)
+    {
+        ok = ok && write(mesh.uvs.get(), mesh.nr_uvs * sizeof(Eigen::Vector2f));
+        ok = ok && write(mesh.uv_idx.data(), mesh.uv_idx.size() * sizeof(int));
+    }
+    ok = ok && write(nodes.data(), nodes.size() * sizeof(LinearBVHNode));
+    return ok && write(references.data(), references.size() * sizeof(int));
+}
+
+bool raytracer::read_mesh_bvh(const unsigned char *data, const MeshBVHLayout &layout, Mesh &mesh, std::vector<LinearBVHNode> &nodes, std::vector<int> &references)
+{
+    auto read_array = [&data](void *dst, size_t bytes)
+    {
+        memcpy(dst, data, bytes);
+        data += bytes;
+    };
+    if (!layout.fits())
+        return false;
+
+    mesh.nr_vertices = layout.nr_vertices;
+    mesh.nr_triangles = layout.nr_triangles;
+    mesh.has_normals = layout.has_normals;
+    mesh.has_uvs = layout.has_uvs;
+    mesh.vertices = std::make_unique<Eigen::Vector3f[]>(mesh.nr_vertices);
+    read_array(mesh.vertices.get(), layout.nr_vertices * sizeof(Eigen::Vector3f));
+    mesh.vertex_idx.resize(layout.nr_triangles * 3);
+    read_array(mesh.vertex_idx.data(), mesh.vertex_idx.size() * sizeof(int));
+    if (mesh.has_normals)
+    {
+        mesh.nr_normals = layout.nr_normals;
+        mesh.normals = std::make_unique<Eigen::Vector3f[]>(mesh.nr_normals);
+        read_array(mesh.normals.get(), layout.nr_normals * sizeof(Eigen::Vector3f));
+        if (layout.indexed_normals)
+        {
+            mesh.normal_idx.resize(layout.nr_triangles * 3);
+            read_array(mesh.normal_idx.data(), mesh.normal_idx.size() * sizeof(int));
+        }
+    }
+    if (mesh.has_uvs)
+    {
+        mesh.nr_uvs = layout.nr_uvs;
+        mesh.uvs = std::make_unique<Eigen::Vector2f[]>(mesh.nr_uvs);
+        read_array(mesh.uvs.get(), layout.nr_uvs * sizeof(Eigen::Vector2f));
+        mesh.uv_idx.resize(layout.nr_triangles * 3);
+        read_array(mesh.uv_idx.data(), mesh.uv_idx.size() * sizeof(int));
+    }
+
+    nodes.resize(layout.nr_nodes);
+    read_array(nodes.data(), nodes.size() * sizeof(LinearBVHNode));
+    references.resize(layout.nr_references);
+    read_array(references.data(), references.size() * sizeof(int));
+    return valid_mesh_bvh(mesh, nodes, references);
+}
+
+static bool valid_indices(const std::vector<int> &indices, int count)
+{
+    for (int idx : indices)
+    {
+        if (idx < 0 || idx >= count)
+            return false;
+    }
+    return true;
+}
+
+bool raytracer::valid_mesh_bvh(const Mesh &mesh, const std::vector<LinearBVHNode> &nodes, const std::vector<int> &references)
+{
+    if (!valid_indices(mesh.vertex_idx, mesh.nr_vertices) || !valid_indices(mesh.normal_idx, mesh.nr_normals) ||
+        !valid_indices(mesh.uv_idx, mesh.nr_uvs) || !valid_indices(references, mesh.nr_triangles) || nodes.empty())
+        return false;
+    // Without indices of their own, the normals are looked up with the vertex indices
+    if (mesh.has_normals && mesh.normal_idx.empty() && mesh.nr_normals != mesh.nr_vertices)
+        return false;
+
+    // The nodes are in depth-first order, so a parent always comes before its children and gives them their depth
+    std::vector<int> depth(nodes.size(), 0);
+    depth[0] = 1;
+    for (size_t i = 0; i < nodes.size(); i++)
+    {
+        const LinearBVHNode &node = nodes[i];
+        if (depth[i] == 0 || depth[i] > max_bvh_depth)
+            return false;
+        if (node.n_primitives > 0)
+        {
+            if (node.primitives_offset < 0 || (size_t)node.primitives_offset + node.n_primitives > references.size())
+                return false;
+            continue;
+        }
+        size_t second = node.second_child_offset;
+        if (node.axis > 2 || node.second_child_offset <= (int)i + 1 || second >= nodes.size() || depth[i + 1] != 0 || depth[second] != 0)
+            return false;
+        depth[i + 1] = depth[second] = depth[i] + 1;
+    }
+    return true;
+}
+
+static std::shared_ptr<BVH> read_cache(const std::string &path, uint64_t key, std::shared_ptr<Material> mat, const BVHBuildParams &params)
+{
+    MappedFile file;
+    if (!file.open(path) || file.size() < sizeof(BVHCacheHeader))
+        return nullptr;
+
+    BVHCacheHeader header;
+    memcpy(&header, file.data(), sizeof(header));
+    MeshBVHLayout layout = cache_layout(header);
+    if (memcmp(header.magic, bvh_cache_magic, sizeof(bvh_cache_magic)) != 0 || header.version != bvh_cache_version ||
+        header.node_size != sizeof(LinearBVHNode) || header.key != key || file.size() - sizeof(header) != layout.payload_size())
+    {
+        Console::GetInstance()->addWarningEntry("[warning] Ignoring invalid BVH cache file " + path);
+        return nullptr;
+    }
+
+    std::shared_ptr<Mesh> mesh = std::make_shared<Mesh>();
+    mesh->shading_type = (ShadingType)header.shading_type;
+    std::vector<LinearBVHNode> nodes;
+    std::vector<int> references;
+    if (!read_mesh_bvh(file.data() + sizeof(header), layout, *mesh, nodes, references))
+    {
+        Console::GetInstance()->addWarningEntry("[warning] Ignoring corrupt BVH cache file " + path);
+        return nullptr;
+    }
+    std::vector<std::shared_ptr<GeometricObject>> objects = {std::make_shared<TriangleMesh>(mesh, std::vector<std::shared_ptr<Material>>{mat})};
+    return std::make_shared<BVH>(objects, nodes, references, params);
+}
+
+void raytracer::make_directory(const std::string &dir)
+{
+#ifdef _WIN32
+    _mkdir(dir.c_str());
+#else
+    mkdir(dir.c_str(), 0755);
+#endif
+}
+
+static bool write_cache(const std::string &cache_dir, const std::string &path, uint64_t key, const Mesh &mesh,
+                        const std::vector<LinearBVHNode> &nodes, const std::vector<int> &references)
+{
+    MeshBVHLayout layout(mesh, nodes, references);
+    BVHCacheHeader header = {};
+    memcpy(header.magic, bvh_cache_magic, sizeof(bvh_cache_magic));
+    header.version = bvh_cache_version;
+    header.node_size = sizeof(LinearBVHNode);
+    header.key = key;
+    header.nr_vertices = layout.nr_vertices;
+    header.nr_triangles = layout.nr_triangles;
+    header.nr_nodes = layout.nr_nodes;
+    header.nr_references = layout.nr_references;
+    header.has_normals = layout.has_normals;
+    header.shading_type = mesh.shading_type;
+    header.has_uvs = layout.has_uvs;
+    header.indexed_normals = layout.indexed_normals;
+    header.nr_normals = layout.nr_normals;
+    header.nr_uvs = layout.nr_uvs;
+
+    make_directory(cache_dir);
+    return write_file_atomically(path, [&](FILE *f)
+                                 { return fwrite(&header, sizeof(header), 1, f) == 1 &&
+                                          write_mesh_bvh(mesh, nodes, references, [f](const void *data, size_t bytes)
+                                                         { return fwrite(data, 1, bytes, f) == bytes; }); });
+}
+
+std::shared_ptr<BVH> raytracer::load_mesh_bvh(const std::string &filename, int shape_index, ShadingType shading_type, std::shared_ptr<Material> mat,
+                                              const BVHBuildParams &params, const std::string &cache_dir)
+{
+    HiResTimer timer;
+    timer.start();
+
+    MappedFile obj_file;
+    if (!obj_file.open(filename))
+    {
+        Console::GetInstance()->addErrorEntry("[error] Failed to open " + filename);
+        return nullptr;
+    }
+    uint64_t key = cache_key(obj_file, shape_index, shading_type, params);
+    obj_file.close();
+
+    std::string path = cache_path(cache_dir, key);
+    std::shared_ptr<BVH> bvh = read_cache(path, key, mat, params);
+    if (bvh != nullptr)
+    {
+        timer.stop();
+        Console::GetInstance()->addSuccesEntry("Loaded " + filename + " from the BVH cache in " +
+                                               std::to_string(timer.elapsed_time_milliseconds()) + " ms");
+        return bvh;
+    }
+
+    tinyobj::attrib_t attrib;
+    std::vector<tinyobj::shape_t> shapes;
+    std::vector<tinyobj::material_t> materials;
+    if (!LoadObj(filename, attrib, shapes, materials) || shape_index < 0 || shape_index >= (int)shapes.size())
+        return nullptr;
+
+    std::shared_ptr<Mesh> mesh = load_mesh(attrib, shapes[shape_index], shading_type);
+    if (mesh->nr_triangles == 0)
+        return nullptr;
+
+    std::vector<Eigen::AlignedBox3f> prim_bounds(mesh->nr_triangles);
+    for (int i = 0; i < mesh->nr_triangles; i++)
+        prim_bounds[i] = mesh->face_bounding_box(i, nullptr);
+
+    std::vector<LinearBVHNode> nodes;
+    std::vector<int> references;
+    build_bvh(prim_bounds, params, nodes, references, [&mesh](int prim, const Eigen::AlignedBox3f &box)
+              { return mesh->clipped_face_bounding_box(prim, nullptr, box); });
+
+    std::vector<std::shared_ptr<GeometricObject>> objects = {std::make_shared<TriangleMesh>(mesh, std::vector<std::shared_ptr<Material>>{mat})};
+    bvh = std::make_shared<BVH>(objects, nodes, references, params);
+
+    if (write_cache(cache_dir, path, key, *mesh, nodes, references))
+        Console::GetInstance()->addLogEntry("Saved the BVH of " + filename + " to " + path);
+    else
+        Console::GetInstance()->addWarningEntry("[warning] Could not write the BVH cache file " + path);
+    return bvh;
+}
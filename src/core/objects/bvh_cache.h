@@ -0,0 +1,72 @@
+#pragma once
+#include <memory>
+#include <string>
+#include <vector>
+#include <functional>
+#include <cstdio>
+#include <cstdint>
+
+#include "bvh.h"
+#include "triangle_mesh.h"
+
+namespace raytracer
+{
+    // 64 bit FNV-1a of a block of memory, continuing from hash. The cache files are named after the hash of their inputs.
+    uint64_t hash_bytes(const void *data, size_t size, uint64_t hash = 14695981039346656037ull);
+
+    // Creates a directory for cache files, if it doesn't exist yet
+    void make_directory(const std::string &dir);
+
+    // Writes a file through a temporary one that is only renamed into place if write succeeds, so an interrupted write never leaves a truncated file behind
+    bool write_file_atomically(const std::string &path, const std::function<bool(FILE *)> &write);
+
+    /*
+     *  How many of each array a mesh with a BVH over its faces has, as stored in the cache files. The arrays follow
+     *  each other in this order: vertices, vertex indices, normals (if has_normals) and their indices (if indexed_normals),
+     *  texture coordinates and their indices (if has_uvs), the nodes and the face of every leaf reference.
+     */
+    struct MeshBVHLayout
+    {
+        uint64_t nr_vertices = 0, nr_triangles = 0, nr_normals = 0, nr_uvs = 0;
+        uint64_t nr_nodes = 0, nr_references = 0;
+        bool has_normals = false, indexed_normals = false, has_uvs = false;
+
+        MeshBVHLayout() = default;
+        MeshBVHLayout(const Mesh &mesh, const std::vector<LinearBVHNode> &nodes, const std::vector<int> &references);
+
+        // Whether every count fits the int fields and offsets of Mesh and LinearBVHNode, which a corrupt header may not
+        bool fits() const;
+
+        // The number of bytes the arrays take, SIZE_MAX if the counts don't fit
+        size_t payload_size() const;
+    };
+
+    // Writes the arrays of a mesh and its BVH in the order of MeshBVHLayout, stopping at the first failed write
+    bool write_mesh_bvh(const Mesh &mesh, const std::vector<LinearBVHNode> &nodes, const std::vector<int> &references,
+                        const std::function<bool(const void *, size_t)> &write);
+
+    /*
+     *  Reads the arrays written by write_mesh_bvh() from data, which must hold layout.payload_size() bytes, into mesh
+     *  (all but its shading type), nodes and references. Returns false if the layout doesn't fit or the arrays fail valid_mesh_bvh().
+     */
+    bool read_mesh_bvh(const unsigned char *data, const MeshBVHLayout &layout, Mesh &mesh, std::vector<LinearBVHNode> &nodes, std::vector<int> &references);
+
+    /*
+     *  Whether a mesh and a flattened BVH over its faces, as read from a file, can be traced without indexing
+     *  out of bounds: every index in range, a normal per vertex if they aren't indexed, every node a child of exactly one earlier node, no deeper than the
+     *  traversal stacks allow, and every leaf within the references.
+     */
+    bool valid_mesh_bvh(const Mesh &mesh, const std::vector<LinearBVHNode> &nodes, const std::vector<int> &references);
+
+    /*
+     *  Loads one shape of an .obj file as a BVH over its triangles, going through an on-disk cache.
+     *  The cache file holds the mesh data and the built tree, and is named after a hash of the .obj
+     *  contents, the shape, the shading type and the build parameters, so any change to those leads
+     *  to a new file. A valid cache file is memory mapped and copied straight into place, skipping
+     *  the .obj parsing, the normal computation and the BVH build entirely.
+     *  The triangles are in object space; place the result in the scene with an Instance if needed.
+     *  Returns nullptr if the model can't be loaded.
+     */
+    std::shared_ptr<BVH> load_mesh_bvh(const std::string &filename, int shape_index, ShadingType shading_type, std::shared_ptr<Material> mat,
+                                       const BVHBuildParams &params = BVHBuildParams(), const std::string &cache_dir = "../cache");
+}
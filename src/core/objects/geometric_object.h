@@ -8,16 +8,152 @@
 #include "hit_info.h"
 #include "interval.h"
 #include "transform.h"
+#include "ray_packet.h"
 
 namespace raytracer
 {
     class Material;
+    class GeometricObject;
+
+    /*
+     *  All that is kept of a hit while searching for the closest one. The HitInfo, with its normal,
+     *  texture coordinates and material, is only built from it once the search is over, so hits that
+     *  a closer one replaces cost no more than their distance.
+     */
+    struct PrimitiveHit
+    {
+        static const int max_instance_depth = 4;
+
+        float t;
+        float beta = 0.0f, gamma = 0.0f;            // triangles: barycentric coordinates of the second and third vertex
+        const GeometricObject *primitive = nullptr; // the object that was hit, it builds the HitInfo
+        int index = 0;                              // which of the object's primitives was hit, see GeometricObject::primitive_count()
+        const GeometricObject *instances[max_instance_depth]; // the instances the primitive was reached through, innermost first
+        int n_instances = 0;
+
+        void record(const GeometricObject *object, float t, float beta = 0.0f, float gamma = 0.0f, int index = 0)
+        {
+            this->primitive = object;
+            this->t = t;
+            this->beta = beta;
+            this->gamma = gamma;
+            this->index = index;
+            this->n_instances = 0;
+        }
+    };
+
     class GeometricObject
     {
     public:
-        virtual bool hit(const raytracer::Ray &r, Interval t_range, HitInfo &rec) const = 0;
+        // Finds the closest intersection in t_range and records it in hit, leaving hit untouched if there is none
+        virtual bool find_hit(const raytracer::Ray &r, Interval t_range, PrimitiveHit &hit) const = 0;
+
+        // Fills rec for a hit find_hit recorded on this object. r is the ray find_hit was given.
+        virtual void surface_interaction(const raytracer::Ray &r, const PrimitiveHit &hit, HitInfo &rec) const
+        {
+        }
+
+        // The closest intersection in t_range, with everything needed to shade it
+        bool hit(const raytracer::Ray &r, Interval t_range, HitInfo &rec) const
+        {
+            PrimitiveHit h;
+            if (!find_hit(r, t_range, h))
+                return false;
+            fill_hit_info(r, h, rec);
+            return true;
+        }
+
+        // Builds the HitInfo of a hit, starting from the outermost instance it was found through
+        static void fill_hit_info(const raytracer::Ray &r, const PrimitiveHit &hit, HitInfo &rec)
+        {
+            const GeometricObject *object = hit.n_instances > 0 ? hit.instances[hit.n_instances - 1] : hit.primitive;
+            object->surface_interaction(r, hit, rec);
+            rec.t = hit.t;
+        }
+
+        // Whether the ray hits the object anywhere in t_range. Used for shadow rays, so it
+        // returns as soon as any intersection is found and computes nothing else.
+        virtual bool shadow_hit(const raytracer::Ray &r, Interval t_range) const = 0;
+
+        // Finds the closest hits of the active lanes of a packet, recording them in hits[lane] and
+        // shortening the lanes' t_max. Returns the mask of lanes hit. Objects that can't do better
+        // just trace the rays one by one.
+        virtual int find_hit_packet(RayPacket &packet, PrimitiveHit *hits, int active) const
+        {
+            int hit_mask = 0;
+            for (int i = 0; i < packet.size; i++)
+            {
+                if ((active & (1 << i)) && find_hit(packet.rays[i], Interval(packet.t_min, packet.t_max[i]), hits[i]))
+                {
+                    packet.t_max[i] = hits[i].t;
+                    hit_mask |= 1 << i;
+                }
+            }
+            return hit_mask;
+        }
+
+        // Returns the mask of the active lanes of the packet that are blocked within their interval
+        virtual int shadow_hit_packet(const RayPacket &packet, int active) const
+        {
+            int hit_mask = 0;
+            for (int i = 0; i < packet.size; i++)
+            {
+                if ((active & (1 << i)) && shadow_hit(packet.rays[i], Interval(packet.t_min, packet.t_max[i])))
+                    hit_mask |= 1 << i;
+            }
+            return hit_mask;
+        }
         virtual Eigen::AlignedBox3f bounding_box() const = 0;
 
+        // The bounds of the part of the object inside box, used to split objects between BVH nodes
+        virtual Eigen::AlignedBox3f clipped_bounding_box(const Eigen::AlignedBox3f &box) const
+        {
+            return bounding_box().intersection(box);
+        }
+
+        /*
+         *  Objects made of many primitives, like a TriangleMesh, let a BVH sort and intersect each of them
+         *  separately, by their index in [0, primitive_count()). The hits record that index. Objects that
+         *  are a single primitive keep the defaults, which ignore the index.
+         */
+        virtual int primitive_count() const
+        {
+            return 1;
+        }
+
+        virtual Eigen::AlignedBox3f primitive_bounding_box(int prim) const
+        {
+            return bounding_box();
+        }
+
+        virtual Eigen::AlignedBox3f clipped_primitive_bounding_box(int prim, const Eigen::AlignedBox3f &box) const
+        {
+            return clipped_bounding_box(box);
+        }
+
+        virtual bool find_primitive_hit(int prim, const raytracer::Ray &r, Interval t_range, PrimitiveHit &hit) const
+        {
+            return find_hit(r, t_range, hit);
+        }
+
+        virtual bool shadow_hit_primitive(int prim, const raytracer::Ray &r, Interval t_range) const
+        {
+            return shadow_hit(r, t_range);
+        }
+
+        // Triangles write the vertices of primitive prim, in the same space as their bounding box, so that a BVH
+        // can intersect them in SIMD blocks instead of calling find_hit(). Other objects return false.
+        virtual bool triangle_vertices(int prim, Eigen::Vector3f vertices[3]) const
+        {
+            return false;
+        }
+
+        // How many instances deep the primitives of the object are nested, see PrimitiveHit::max_instance_depth
+        virtual int instance_depth() const
+        {
+            return 0;
+        }
+
         virtual Eigen::Vector3f sample() const
         {
             return Eigen::Vector3f(0, 0, 0);
@@ -38,6 +174,14 @@ namespace raytracer
             return 0.0;
         }
 
+        // The ray in the space the object's geometry is defined in
+        raytracer::Ray object_space_ray(const raytracer::Ray &r) const
+        {
+            if (transform == nullptr)
+                return r;
+            return transform->inverse_transform_ray(r);
+        }
+
         void set_transform(Transform *t)
         {
             this->transform = t;
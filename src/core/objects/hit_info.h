@@ -15,7 +15,7 @@ namespace raytracer
         Eigen::Vector3f normal;
         float t;
         float u, v;
-        std::shared_ptr<Material> material;
+        Material *material = nullptr; // owned by the object hit, so copying a HitInfo touches no reference counts
         World &world;
         int depth = 0;
 
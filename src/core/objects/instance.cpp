@@ -0,0 +1,101 @@
+#include <cassert>
+#include "instance.h"
+#include "console.h"
+
+using namespace raytracer;
+
+Instance::Instance(const std::shared_ptr<GeometricObject> &object, Transform *t)
+{
+    this->object = object;
+    this->set_transform(t);
+
+    // A hit records the instances it was found through in a fixed size array
+    if (object->instance_depth() + 1 > PrimitiveHit::max_instance_depth)
+    {
+        too_deep = true;
+        Console::GetInstance()->addErrorEntry("[Error] Instances are nested more than " + std::to_string(PrimitiveHit::max_instance_depth) +
+                                              " deep. The instance was left empty.");
+    }
+}
+
+void Instance::push_instance(PrimitiveHit &hit) const
+{
+    assert(hit.n_instances < PrimitiveHit::max_instance_depth);
+    hit.instances[hit.n_instances++] = this;
+}
+
+bool Instance::find_hit(const raytracer::Ray &r, Interval t_range, PrimitiveHit &hit) const
+{
+    if (too_deep || (r.is_camera_ray && !this->visible_to_camera))
+        return false;
+
+    if (!object->find_hit(object_space_ray(r), t_range, hit))
+        return false;
+
+    push_instance(hit);
+    return true;
+}
+
+void Instance::surface_interaction(const raytracer::Ray &r, const PrimitiveHit &hit, HitInfo &rec) const
+{
+    // Let the next instance down (or the primitive) build the hit in object space
+    PrimitiveHit inner = hit;
+    inner.n_instances--;
+    fill_hit_info(object_space_ray(r), inner, rec);
+
+    // The normal transform preserves the sign of dot(direction, normal), so front_face stays valid
+    rec.p = transform->transform_point(rec.p);
+    rec.normal = transform->transform_normal(rec.normal);
+    if (this->material != nullptr)
+        rec.material = this->material.get();
+}
+
+bool Instance::shadow_hit(const raytracer::Ray &r, Interval t_range) const
+{
+    if (too_deep)
+        return false;
+    return object->shadow_hit(object_space_ray(r), t_range);
+}
+
+RayPacket Instance::object_space_packet(const RayPacket &packet) const
+{
+    RayPacket tp;
+    for (int i = 0; i < packet.size; i++)
+        tp.add(object_space_ray(packet.rays[i]), Interval(packet.t_min, packet.t_max[i]));
+    return tp;
+}
+
+int Instance::find_hit_packet(RayPacket &packet, PrimitiveHit *hits, int active) const
+{
+    if (too_deep || (packet.rays[0].is_camera_ray && !this->visible_to_camera))
+        return 0;
+
+    RayPacket tp = object_space_packet(packet);
+    int hit_mask = object->find_hit_packet(tp, hits, active);
+    for (int lanes = hit_mask; lanes != 0; lanes &= lanes - 1)
+    {
+        int i = __builtin_ctz(lanes);
+        packet.t_max[i] = tp.t_max[i];
+        push_instance(hits[i]);
+    }
+    return hit_mask;
+}
+
+int Instance::shadow_hit_packet(const RayPacket &packet, int active) const
+{
+    if (too_deep)
+        return 0;
+    return object->shadow_hit_packet(object_space_packet(packet), active);
+}
+
+Eigen::AlignedBox3f Instance::bounding_box() const
+{
+    // Not cached, so refitting the BVH over the instances picks up a refitted object
+    return transform->transform_bounding_box(object->bounding_box());
+}
+
+int Instance::instance_depth() const
+{
+    // A rejected instance never passes hits on, so it doesn't make the ones around it too deep
+    return too_deep ? 0 : object->instance_depth() + 1;
+}
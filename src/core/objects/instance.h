@@ -0,0 +1,42 @@
+#pragma once
+#include <memory>
+
+#include <Eigen/Geometry>
+
+#include "geometric_object.h"
+
+namespace raytracer
+{
+    /*
+     *  A copy of another object (usually the BVH of a whole mesh) placed in the scene with its own transform.
+     *  Any number of instances can share the same object, so the geometry and its bottom level BVH are
+     *  stored and built only once. A BVH over the instances themselves forms the top level of the hierarchy.
+     *  The ray is moved into the object's space instead of the object into world space.
+     *  If the instance has a material set, it overrides the materials of the shared geometry.
+     *  Instances can be nested up to PrimitiveHit::max_instance_depth deep; an instance that would
+     *  go deeper is rejected when it is made, and stays empty.
+     */
+    class Instance : public GeometricObject
+    {
+    public:
+        Instance(const std::shared_ptr<GeometricObject> &object, Transform *t);
+
+        bool find_hit(const raytracer::Ray &r, Interval t_range, PrimitiveHit &hit) const override;
+        void surface_interaction(const raytracer::Ray &r, const PrimitiveHit &hit, HitInfo &rec) const override;
+        bool shadow_hit(const raytracer::Ray &r, Interval t_range) const override;
+        int find_hit_packet(RayPacket &packet, PrimitiveHit *hits, int active) const override;
+        int shadow_hit_packet(const RayPacket &packet, int active) const override;
+        Eigen::AlignedBox3f bounding_box() const override;
+        int instance_depth() const override;
+
+    private:
+        std::shared_ptr<GeometricObject> object;
+        bool too_deep = false; // nested deeper than a hit can record, never hit
+
+        // The packet moved into object space, lane for lane
+        RayPacket object_space_packet(const RayPacket &packet) const;
+
+        // Marks a hit found in the object as found through this instance, so that surface_interaction transforms it back
+        void push_instance(PrimitiveHit &hit) const;
+    };
+}
@@ -0,0 +1,276 @@
+#include "mesh.h"
+#include "thread_pool.h"
+using namespace raytracer;
+
+void Mesh::face_vertices(int f, const Transform *t, Eigen::Vector3f vertices[3]) const
+{
+    const int *v = &vertex_idx[3 * f];
+    for (int i = 0; i < 3; i++)
+    {
+        vertices[i] = position(v[i]);
+        if (t != nullptr)
+            vertices[i] = t->transform_point(vertices[i]);
+    }
+}
+
+bool Mesh::intersect_face(int f, const raytracer::Ray &r, Interval t_range, float &t, float &beta, float &gamma) const
+{
+    // Möller–Trumbore, the same test the BVH runs on blocks of triangles
+    const int *v = &vertex_idx[3 * f];
+    Eigen::Vector3f v0 = position(v[0]);
+    Eigen::Vector3f e1 = position(v[1]) - v0;
+    Eigen::Vector3f e2 = position(v[2]) - v0;
+    Eigen::Vector3f pvec = r.direction.cross(e2);
+    float inv_det = 1.0f / e1.dot(pvec);
+
+    Eigen::Vector3f tvec = r.origin - v0;
+    beta = tvec.dot(pvec) * inv_det;
+    if (beta < 0.0f)
+        return false;
+
+    Eigen::Vector3f qvec = tvec.cross(e1);
+    gamma = r.direction.dot(qvec) * inv_det;
+    if (gamma < 0.0f || beta + gamma > 1.0f)
+        return false;
+
+    t = e2.dot(qvec) * inv_det;
+
+    // Also rejects the NaN distances of degenerate triangles
+    return t >= t_range.min && t <= t_range.max;
+}
+
+Eigen::AlignedBox3f Mesh::face_bounding_box(int f, const Transform *t) const
+{
+    const int *v = &vertex_idx[3 * f];
+    Eigen::AlignedBox3f bbox;
+    bbox.extend(position(v[0]));
+    bbox.extend(position(v[1]));
+    bbox.extend(position(v[2]));
+
+    // Displace the corners by a tiny amount to avoid degenerate bounding boxes
+    bbox.min() -= Eigen::Vector3f(0.0001, 0.0001, 0.0001);
+    bbox.max() += Eigen::Vector3f(0.0001, 0.0001, 0.0001);
+
+    if (t != nullptr)
+        return t->transform_bounding_box(bbox);
+    return bbox;
+}
+
+Eigen::AlignedBox3f Mesh::clipped_face_bounding_box(int f, const Transform *t, const Eigen::AlignedBox3f &box) const
+{
+    // Clip the triangle against the six planes of the box (Sutherland-Hodgman).
+    // Every plane adds at most one vertex to the polygon.
+    Eigen::Vector3f polygon[9], clipped[9];
+    int n = 3;
+    face_vertices(f, t, polygon);
+
+    for (int plane = 0; plane < 6 && n > 0; plane++)
+    {
+        int axis = plane % 3;
+        bool is_max = plane >= 3;
+        float position = is_max ? box.max()[axis] : box.min()[axis];
+        auto inside = [&](const Eigen::Vector3f &p)
+        { return is_max ? p[axis] <= position : p[axis] >= position; };
+
+        int m = 0;
+        for (int i = 0; i < n; i++)
+        {
+            const Eigen::Vector3f &current = polygon[i];
+            const Eigen::Vector3f &next = polygon[(i + 1) % n];
+            if (inside(current))
+                clipped[m++] = current;
+            if (inside(current) != inside(next))
+            {
+                float t = (position - current[axis]) / (next[axis] - current[axis]);
+                clipped[m] = current + t * (next - current);
+                clipped[m++][axis] = position;
+            }
+        }
+        std::copy(clipped, clipped + m, polygon);
+        n = m;
+    }
+
+    Eigen::AlignedBox3f bbox;
+    for (int i = 0; i < n; i++)
+        bbox.extend(polygon[i]);
+    if (bbox.isEmpty())
+        return bbox;
+
+    // Same padding as the full bounding box, without leaving the clipping box
+    bbox.min() -= Eigen::Vector3f(0.0001, 0.0001, 0.0001);
+    bbox.max() += Eigen::Vector3f(0.0001, 0.0001, 0.0001);
+    return bbox.intersection(box);
+}
+
+void Mesh::interpolate(int f, float beta, float gamma, HitInfo &rec) const
+{
+    const int *v = &vertex_idx[3 * f];
+
+    // Interpolate normals to archieve smooth shading, if available
+    if (shading_type == SMOOTH && has_normals)
+    {
+        const int *n = normal_idx.empty() ? v : &normal_idx[3 * f];
+        rec.normal = ((1 - beta - gamma) * normal(n[0]) + beta * normal(n[1]) + gamma * normal(n[2])).normalized();
+    }
+    else
+    {
+        Eigen::Vector3f v0 = position(v[0]);
+        rec.normal = ((position(v[1]) - v0).cross(position(v[2]) - v0)).normalized();
+    }
+
+    if (has_uvs)
+    {
+        const int *t = &uv_idx[3 * f];
+        Eigen::Vector2f uv = (1 - beta - gamma) * this->uv(t[0]) + beta * this->uv(t[1]) + gamma * this->uv(t[2]);
+        rec.u = uv.x();
+        rec.v = uv.y();
+    }
+}
+
+size_t Mesh::memory_usage() const
+{
+    size_t bytes = sizeof(Mesh) + (vertex_idx.size() + normal_idx.size() + uv_idx.size()) * sizeof(int);
+    if (compressed)
+        return bytes + quantized_vertices.size() * sizeof(uint16_t) + octahedral_normals.size() * sizeof(uint32_t) + half_uvs.size() * sizeof(uint16_t);
+    return bytes + nr_vertices * sizeof(Eigen::Vector3f) + (has_normals ? nr_normals * sizeof(Eigen::Vector3f) : 0) +
+           (has_uvs ? nr_uvs * sizeof(Eigen::Vector2f) : 0);
+}
+
+void Mesh::compress()
+{
+    // ZoneScoped;
+    if (compressed)
+        return;
+
+    // The quantized positions are a grid over the bounds of the mesh. Shared vertices stay shared,
+    // so the mesh stays watertight, only slightly moved.
+    Eigen::AlignedBox3f bounds;
+    for (int v = 0; v < nr_vertices; v++)
+        bounds.extend(vertices[v]);
+    quantization_origin = bounds.min();
+    quantization_scale = bounds.sizes() / 65535.0f;
+
+    ThreadPool *pool = ThreadPool::GetInstance();
+    quantized_vertices.resize(3 * nr_vertices);
+    pool->parallel_for(0, nr_vertices, 16384, [&](size_t v)
+                       {
+        for (int a = 0; a < 3; a++)
+        {
+            float q = quantization_scale[a] > 0.0f ? (vertices[v][a] - quantization_origin[a]) / quantization_scale[a] : 0.0f;
+            quantized_vertices[3 * v + a] = (uint16_t)std::min(std::max(std::lround(q), 0l), 65535l);
+        } });
+    vertices.reset();
+
+    if (has_normals)
+    {
+        octahedral_normals.resize(nr_normals);
+        pool->parallel_for(0, nr_normals, 16384, [&](size_t n)
+                           { octahedral_normals[n] = encode_octahedral(normals[n]); });
+        normals.reset();
+    }
+    if (has_uvs)
+    {
+        half_uvs.resize(2 * nr_uvs);
+        pool->parallel_for(0, nr_uvs, 16384, [&](size_t t)
+                           {
+            half_uvs[2 * t] = float_to_half(uvs[t].x());
+            half_uvs[2 * t + 1] = float_to_half(uvs[t].y()); });
+        uvs.reset();
+    }
+    compressed = true;
+}
+
+// Every face adds its unnormalized normal, whose length is twice its area, to its three vertices.
+// The faces around each vertex are gathered first so that the sums can be computed in parallel
+// without two threads writing the same vertex.
+void Mesh::compute_smooth_normals()
+{
+    ThreadPool *pool = ThreadPool::GetInstance();
+    std::vector<Eigen::Vector3f> face_normals(nr_triangles);
+    pool->parallel_for(0, nr_triangles, 16384, [&](size_t f)
+                       {
+        const int *v = &vertex_idx[3 * f];
+        Eigen::Vector3f v0 = vertices[v[0]];
+        face_normals[f] = (vertices[v[1]] - v0).cross(vertices[v[2]] - v0); });
+
+    // vertex_faces[face_offset[v]..face_offset[v + 1]) are the faces sharing vertex v
+    std::vector<int> face_offset(nr_vertices + 1, 0);
+    for (int idx : vertex_idx)
+        face_offset[idx + 1]++;
+    for (int v = 0; v < nr_vertices; v++)
+        face_offset[v + 1] += face_offset[v];
+    std::vector<int> vertex_faces(vertex_idx.size());
+    std::vector<int> next = face_offset;
+    for (size_t i = 0; i < vertex_idx.size(); i++)
+        vertex_faces[next[vertex_idx[i]]++] = i / 3;
+
+    normals = std::make_unique<Eigen::Vector3f[]>(nr_vertices);
+    pool->parallel_for(0, nr_vertices, 16384, [&](size_t v)
+                       {
+        Eigen::Vector3f weighted_normal(0, 0, 0);
+        for (int i = face_offset[v]; i < face_offset[v + 1]; i++)
+            weighted_normal += face_normals[vertex_faces[i]];
+        normals[v] = weighted_normal.normalized(); });
+    nr_normals = nr_vertices;
+    normal_idx.clear();
+    has_normals = true;
+}
+
+std::shared_ptr<Mesh> raytracer::load_mesh(const tinyobj::attrib_t &attrib, const tinyobj::shape_t &shape, ShadingType shading_type)
+{
+    // ZoneScoped;
+    ThreadPool *pool = ThreadPool::GetInstance();
+    std::shared_ptr<Mesh> mesh = std::make_shared<Mesh>();
+    mesh->shading_type = shading_type;
+
+    mesh->nr_vertices = attrib.vertices.size() / 3;
+    int nr_faces = shape.mesh.num_face_vertices.size();
+    mesh->nr_triangles = nr_faces;
+    // The loader triangulates every face
+    assert(shape.mesh.indices.size() == 3 * (size_t)nr_faces);
+
+    mesh->vertices = std::make_unique<Eigen::Vector3f[]>(mesh->nr_vertices);
+    pool->parallel_for(0, mesh->nr_vertices, 16384, [&](size_t v)
+                       { mesh->vertices[v] = Eigen::Vector3f(attrib.vertices[3 * v + 0], attrib.vertices[3 * v + 1], attrib.vertices[3 * v + 2]); });
+
+    mesh->vertex_idx.resize(nr_faces * 3);
+    pool->parallel_for(0, mesh->vertex_idx.size(), 16384, [&](size_t i)
+                       { mesh->vertex_idx[i] = shape.mesh.indices[i].vertex_index; });
+
+    // Normals and texture coordinates from the file, if every corner of the shape has one. They keep
+    // their own indices, so seams where a vertex has several of them stay sharp. Flat shading
+    // doesn't use normals at all.
+    bool file_normals = shading_type == SMOOTH && !attrib.normals.empty(), file_uvs = !attrib.texcoords.empty();
+    for (const tinyobj::index_t &idx : shape.mesh.indices)
+    {
+        file_normals &= idx.normal_index >= 0;
+        file_uvs &= idx.texcoord_index >= 0;
+    }
+    if (file_normals)
+    {
+        mesh->nr_normals = attrib.normals.size() / 3;
+        mesh->normals = std::make_unique<Eigen::Vector3f[]>(mesh->nr_normals);
+        pool->parallel_for(0, mesh->nr_normals, 16384, [&](size_t n)
+                           { mesh->normals[n] = Eigen::Vector3f(attrib.normals[3 * n + 0], attrib.normals[3 * n + 1], attrib.normals[3 * n + 2]).normalized(); });
+        mesh->normal_idx.resize(nr_faces * 3);
+        pool->parallel_for(0, mesh->normal_idx.size(), 16384, [&](size_t i)
+                           { mesh->normal_idx[i] = shape.mesh.indices[i].normal_index; });
+        mesh->has_normals = true;
+    }
+    if (file_uvs)
+    {
+        mesh->nr_uvs = attrib.texcoords.size() / 2;
+        mesh->uvs = std::make_unique<Eigen::Vector2f[]>(mesh->nr_uvs);
+        pool->parallel_for(0, mesh->nr_uvs, 16384, [&](size_t t)
+                           { mesh->uvs[t] = Eigen::Vector2f(attrib.texcoords[2 * t + 0], attrib.texcoords[2 * t + 1]); });
+        mesh->uv_idx.resize(nr_faces * 3);
+        pool->parallel_for(0, mesh->uv_idx.size(), 16384, [&](size_t i)
+                           { mesh->uv_idx[i] = shape.mesh.indices[i].texcoord_index; });
+        mesh->has_uvs = true;
+    }
+
+    // Compute the normals at each vertex, but don't bother if using flat shading
+    if (shading_type == SMOOTH && !mesh->has_normals)
+        mesh->compute_smooth_normals();
+    return mesh;
+}
@@ -3,6 +3,11 @@
 #include <memory>
 #include "utilities.h"
 #include "obj_loader.h"
+#include "ray.h"
+#include "interval.h"
+#include "transform.h"
+#include "hit_info.h"
+#include "quantization.h"
 namespace raytracer
 {
     enum ShadingType
@@ -10,19 +15,85 @@ namespace raytracer
         FLAT,
         SMOOTH
     };
-    
+
+    /*
+     *  The shared data of a triangle mesh: face f uses the vertices vertex_idx[3f, 3f + 3).
+     *  Normals and texture coordinates are indexed per corner like in the .obj file, so a vertex
+     *  on a seam can have a different one in each face. Computed normals are per vertex instead.
+     *  The geometry of a face is computed here, in the space the vertices are in, so that the
+     *  objects built over a mesh (MeshTriangle, TriangleMesh) only add their transform and material.
+     */
     class Mesh
     {
     public:
         int nr_triangles, nr_vertices;
+        int nr_normals = 0, nr_uvs = 0;
         bool has_normals = false;
+        bool has_uvs = false;
         std::vector<int> vertex_idx;
+        std::vector<int> normal_idx; // the normal of every corner, empty if the normals are per vertex
+        std::vector<int> uv_idx;     // the texture coordinates of every corner
         std::unique_ptr<Eigen::Vector3f[]> vertices;
         std::unique_ptr<Eigen::Vector3f[]> normals;
+        std::unique_ptr<Eigen::Vector2f[]> uvs;
         ShadingType shading_type = ShadingType::SMOOTH;
 
-        // std::vector<std::vector<int> > vertex_faces;  // a list of all the triangles that share a particular vertex
+        /*
+         *  After compress(), the arrays above are released and the vertex data is only kept in these
+         *  (6, 4 and 4 bytes instead of 12, 12 and 8), decoded whenever a face is used:
+         *  positions as 16 bit fixed point within the bounds of the mesh, normals octahedral encoded
+         *  and texture coordinates as half floats.
+         */
+        bool compressed = false;
+        Eigen::Vector3f quantization_origin, quantization_scale;
+        std::vector<uint16_t> quantized_vertices; // x, y, z per vertex
+        std::vector<uint32_t> octahedral_normals;
+        std::vector<uint16_t> half_uvs; // u, v per texture coordinate
 
         Mesh() {}
+
+        Eigen::Vector3f position(int v) const
+        {
+            if (!compressed)
+                return vertices[v];
+            const uint16_t *q = &quantized_vertices[3 * v];
+            return quantization_origin + quantization_scale.cwiseProduct(Eigen::Vector3f(q[0], q[1], q[2]));
+        }
+
+        Eigen::Vector3f normal(int n) const
+        {
+            return compressed ? decode_octahedral(octahedral_normals[n]) : normals[n];
+        }
+
+        Eigen::Vector2f uv(int t) const
+        {
+            return compressed ? Eigen::Vector2f(half_to_float(half_uvs[2 * t]), half_to_float(half_uvs[2 * t + 1])) : uvs[t];
+        }
+
+        // Bytes taken by the vertex data and the indices
+        size_t memory_usage() const;
+
+        // Switches to the compact representation for good. Must be done before building anything over the mesh.
+        void compress();
+
+        // The vertices of face f, moved by t unless it is null
+        void face_vertices(int f, const Transform *t, Eigen::Vector3f vertices[3]) const;
+
+        // Möller–Trumbore against face f, returning the distance and the barycentric coordinates of the hit
+        bool intersect_face(int f, const raytracer::Ray &r, Interval t_range, float &t, float &beta, float &gamma) const;
+
+        Eigen::AlignedBox3f face_bounding_box(int f, const Transform *t) const;
+
+        // The bounds of the part of face f, moved by t, that lies inside box
+        Eigen::AlignedBox3f clipped_face_bounding_box(int f, const Transform *t, const Eigen::AlignedBox3f &box) const;
+
+        // Fills the normal and texture coordinates of rec at a hit on face f, in the space of the vertices
+        void interpolate(int f, float beta, float gamma, HitInfo &rec) const;
+
+        // Area weighted vertex normals, for smooth shading of meshes that don't come with normals
+        void compute_smooth_normals();
     };
-}
\ No newline at end of file
+
+    // Reads one shape of an .obj file, with its normals and texture coordinates when the file has them
+    std::shared_ptr<Mesh> load_mesh(const tinyobj::attrib_t &attrib, const tinyobj::shape_t &shape, ShadingType shading_type);
+}
@@ -19,8 +19,12 @@ namespace raytracer
     {
     public:
         MeshTriangle(const std::shared_ptr<Mesh> &mesh, int triangle_number, std::shared_ptr<Material> mat);
-        bool hit(const raytracer::Ray &r, Interval t_range, HitInfo &rec) const override;
+        bool find_hit(const raytracer::Ray &r, Interval t_range, PrimitiveHit &hit) const override;
+        bool shadow_hit(const raytracer::Ray &r, Interval t_range) const override;
         Eigen::AlignedBox3f bounding_box() const override;
+        Eigen::AlignedBox3f clipped_bounding_box(const Eigen::AlignedBox3f &box) const override;
+        bool triangle_vertices(int prim, Eigen::Vector3f vertices[3]) const override;
+        void surface_interaction(const raytracer::Ray &r, const PrimitiveHit &hit, HitInfo &rec) const override;
 
         std::ostream &operator<<(std::ostream &out)
         {
@@ -33,7 +37,17 @@ namespace raytracer
     public:
         std::shared_ptr<Mesh> mesh;
         const int *v;
+
+    private:
+        int face() const
+        {
+            return (v - mesh->vertex_idx.data()) / 3;
+        }
     };
 
+    /*
+     *  One MeshTriangle per face of a shape. Prefer a TriangleMesh, which holds all the faces in a
+     *  single object, unless the triangles need their own materials or transforms.
+     */
     std::vector<std::shared_ptr<MeshTriangle>> create_triangle_mesh(const tinyobj::attrib_t &attrib, const tinyobj::shape_t &shape, ShadingType shading_type, std::shared_ptr<Material> mat, Transform *t);
 }
\ No newline at end of file
@@ -0,0 +1,609 @@
+#include <cstdio>
+#include <cstring>
+#include <climits>
+#include <algorithm>
+
+#include "streamed_mesh.h"
+#include "triangle_mesh.h"
+#include "bvh_cache.h"
+#include "thread_pool.h"
+#include "obj_loader.h"
+#include "clock_util.h"
+#include "console.h"
+using namespace raytracer;
+
+// Bump whenever the layout of the cluster file changes
+static const uint32_t cluster_file_version = 2;
+
+/*
+ *  The cluster file is this header, a ClusterRecord per cluster and then the data of every cluster
+ *  at its offset: its mesh and BVH in the order of MeshBVHLayout. All indices are local to the cluster.
+ */
+struct ClusterFileHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t node_size; // sizeof(LinearBVHNode) of the writer
+    uint64_t key;
+    uint64_t nr_clusters;
+    uint32_t shading_type;
+    uint32_t has_normals;
+    uint32_t has_uvs;
+    uint32_t indexed_normals;
+};
+
+struct ClusterRecord
+{
+    uint64_t offset;
+    float bounds[6];
+    int32_t first_face;
+    uint32_t nr_vertices;
+    uint32_t nr_triangles;
+    uint32_t nr_nodes;
+    uint32_t nr_references;
+    uint32_t nr_normals;
+    uint32_t nr_uvs;
+    uint32_t pad;
+};
+
+static const char cluster_file_magic[8] = {'R', 'T', 'C', 'L', 'U', 'S', 'T', 'R'};
+
+static MeshBVHLayout cluster_layout(const ClusterFileHeader &h, const ClusterRecord &c)
+{
+    MeshBVHLayout layout;
+    layout.nr_vertices = c.nr_vertices;
+    layout.nr_triangles = c.nr_triangles;
+    layout.nr_normals = c.nr_normals;
+    layout.nr_uvs = c.nr_uvs;
+    layout.nr_nodes = c.nr_nodes;
+    layout.nr_references = c.nr_references;
+    layout.has_normals = h.has_normals != 0;
+    layout.indexed_normals = h.indexed_normals != 0;
+    layout.has_uvs = h.has_uvs != 0;
+    return layout;
+}
+
+/*
+ *  Every thread that looks up clusters gets a record holding the epoch it is pinned at, 0 if it isn't.
+ *  The records are never freed; the record of a thread that has exited is reused by a later one.
+ */
+struct PinRecord
+{
+    std::atomic<uint64_t> epoch{0};
+    std::atomic<bool> in_use{true};
+    int depth = 0; // nested pins, only touched by the owning thread
+    int index = 0;
+    PinRecord *next = nullptr;
+};
+
+static std::atomic<uint64_t> global_epoch{1};
+static std::atomic<PinRecord *> pin_records{nullptr};
+static std::atomic<int> nr_pin_records{0};
+
+static PinRecord *acquire_pin_record()
+{
+    for (PinRecord *record = pin_records.load(); record != nullptr; record = record->next)
+    {
+        bool in_use = false;
+        if (!record->in_use.load(std::memory_order_relaxed) && record->in_use.compare_exchange_strong(in_use, true))
+            return record;
+    }
+    PinRecord *record = new PinRecord();
+    record->index = nr_pin_records.fetch_add(1);
+    record->next = pin_records.load();
+    while (!pin_records.compare_exchange_weak(record->next, record))
+        ;
+    return record;
+}
+
+// Hands the record of a thread back when it exits
+struct ThreadPinRecord
+{
+    PinRecord *record = acquire_pin_record();
+    ~ThreadPinRecord() { record->in_use.store(false, std::memory_order_release); }
+};
+
+static PinRecord &thread_pin_record()
+{
+    thread_local ThreadPinRecord holder;
+    return *holder.record;
+}
+
+// The pin is sequentially consistent with the loads of the slots that follow it, and eviction with the scan of the pins
+static void pin(PinRecord &record)
+{
+    if (record.depth++ == 0)
+        record.epoch.store(global_epoch.load());
+}
+
+static void unpin(PinRecord &record)
+{
+    if (--record.depth == 0)
+        record.epoch.store(0, std::memory_order_release);
+}
+
+static uint64_t oldest_pinned_epoch()
+{
+    uint64_t oldest = UINT64_MAX;
+    for (PinRecord *record = pin_records.load(); record != nullptr; record = record->next)
+    {
+        uint64_t epoch = record->epoch.load();
+        if (epoch != 0)
+            oldest = std::min(oldest, epoch);
+    }
+    return oldest;
+}
+
+ClusterCache::ClusterRef::~ClusterRef()
+{
+    if (cluster != nullptr)
+        unpin(thread_pin_record());
+}
+
+ClusterCache::ClusterCache(size_t max_bytes, int nr_clusters)
+    : max_bytes(max_bytes), slots(std::make_unique<Slot[]>(nr_clusters)), owners(nr_clusters)
+{
+}
+
+ClusterCache::ClusterRef ClusterCache::get(int id, const std::function<std::shared_ptr<StreamedCluster>()> &load)
+{
+    PinRecord &record = thread_pin_record();
+    Slot &slot = slots[id];
+    pin(record);
+    const StreamedCluster *cluster = slot.cluster.load();
+    if (cluster != nullptr)
+    {
+        uint64_t now = miss_clock.load(std::memory_order_relaxed);
+        if (slot.last_used.load(std::memory_order_relaxed) != now)
+            slot.last_used.store(now, std::memory_order_relaxed);
+        hit_counters[record.index % nr_hit_counters].hits.fetch_add(1, std::memory_order_relaxed);
+        return ClusterRef(cluster);
+    }
+
+    // Read unpinned and outside the lock, so a slow read holds up neither the freeing of evicted clusters nor the other threads
+    unpin(record);
+    std::shared_ptr<const StreamedCluster> loaded = load();
+
+    // Evicted clusters are released after unlocking, freeing a cluster shouldn't hold up the other threads
+    std::vector<std::shared_ptr<const StreamedCluster>> freed;
+    pin(record);
+    std::lock_guard<std::mutex> lock(mutex);
+    stats.misses++;
+    uint64_t now = miss_clock.fetch_add(1, std::memory_order_relaxed) + 1;
+    cluster = slot.cluster.load(std::memory_order_relaxed);
+    if (cluster != nullptr)
+        return ClusterRef(cluster); // another thread loaded it in the meantime
+
+    while (!resident.empty() && stats.resident_bytes + loaded->bytes > max_bytes)
+    {
+        // The resident cluster found the longest ago, with the clusters found between the same two misses in no particular order
+        auto victim = std::min_element(resident.begin(), resident.end(), [this](int a, int b)
+                                       { return slots[a].last_used.load(std::memory_order_relaxed) < slots[b].last_used.load(std::memory_order_relaxed); });
+        evict(*victim);
+        *victim = resident.back();
+        resident.pop_back();
+    }
+    take_unused_retired(freed);
+
+    owners[id] = loaded;
+    resident.push_back(id);
+    slot.last_used.store(now, std::memory_order_relaxed);
+    slot.cluster.store(loaded.get(), std::memory_order_release);
+    stats.resident_bytes += loaded->bytes;
+    stats.peak_resident_bytes = std::max(stats.peak_resident_bytes, stats.resident_bytes);
+    stats.resident_clusters = resident.size();
+    return ClusterRef(loaded.get());
+}
+
+void ClusterCache::evict(int id)
+{
+    // Threads pinned from now on can't find it anymore, those pinned before may still be using it
+    slots[id].cluster.store(nullptr);
+    stats.resident_bytes -= owners[id]->bytes;
+    stats.evictions++;
+    retired.push_back(Retired{std::move(owners[id]), global_epoch.fetch_add(1)});
+}
+
+void ClusterCache::take_unused_retired(std::vector<std::shared_ptr<const StreamedCluster>> &freed)
+{
+    uint64_t oldest = oldest_pinned_epoch();
+    auto unused = std::partition(retired.begin(), retired.end(), [oldest](const Retired &r)
+                                 { return r.epoch >= oldest; });
+    for (auto it = unused; it != retired.end(); it++)
+        freed.push_back(std::move(it->cluster));
+    retired.erase(unused, retired.end());
+}
+
+ClusterCacheStatistics ClusterCache::statistics() const
+{
+    ClusterCacheStatistics s;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        s = stats;
+    }
+    for (const HitCounter &counter : hit_counters)
+        s.hits += counter.hits.load(std::memory_order_relaxed);
+    return s;
+}
+
+void ClusterCache::log_statistics(const std::string &name) const
+{
+    ClusterCacheStatistics s = statistics();
+    uint64_t lookups = s.hits + s.misses;
+    auto megabytes = [](size_t bytes)
+    { return std::to_string(bytes >> 20) + " MB"; };
+    Console::GetInstance()->addLogEntry("Clusters of " + name + ": " + std::to_string(s.misses) + " loads in " + std::to_string(lookups) + " lookups (" +
+                                        std::to_string(lookups > 0 ? 100 * s.misses / lookups : 0) + "%), " + std::to_string(s.evictions) + " evictions, " +
+                                        std::to_string(s.resident_clusters) + " resident taking " + megabytes(s.resident_bytes) + " of " +
+                                        megabytes(max_bytes) + " (peak " + megabytes(s.peak_resident_bytes) + ")");
+}
+
+StreamedMesh::StreamedMesh(const std::string &cluster_file, uint64_t key, std::shared_ptr<Material> mat, const StreamingParams &params)
+{
+    this->material = mat;
+    if (!file.open(cluster_file) || file.size() < sizeof(ClusterFileHeader))
+        return;
+
+    ClusterFileHeader header;
+    memcpy(&header, file.data(), sizeof(header));
+    if (memcmp(header.magic, cluster_file_magic, sizeof(cluster_file_magic)) != 0 || header.version != cluster_file_version ||
+        header.node_size != sizeof(LinearBVHNode) || header.key != key ||
+        header.nr_clusters > (file.size() - sizeof(header)) / sizeof(ClusterRecord) || header.nr_clusters > INT_MAX)
+    {
+        Console::GetInstance()->addWarningEntry("[warning] Ignoring invalid cluster file " + cluster_file);
+        file.close();
+        return;
+    }
+    shading_type = (ShadingType)header.shading_type;
+
+    std::vector<ClusterInfo> table(header.nr_clusters);
+    for (size_t c = 0; c < table.size(); c++)
+    {
+        ClusterRecord record;
+        memcpy(&record, file.data() + sizeof(header) + c * sizeof(ClusterRecord), sizeof(record));
+        if (record.offset > file.size() || cluster_layout(header, record).payload_size() > file.size() - record.offset)
+        {
+            Console::GetInstance()->addWarningEntry("[warning] Ignoring truncated cluster file " + cluster_file);
+            file.close();
+            return;
+        }
+        table[c].bounds = Eigen::AlignedBox3f(Eigen::Vector3f(record.bounds[0], record.bounds[1], record.bounds[2]),
+                                              Eigen::Vector3f(record.bounds[3], record.bounds[4], record.bounds[5]));
+        table[c].first_face = record.first_face;
+    }
+    clusters = std::move(table);
+    cluster_cache = std::make_unique<ClusterCache>(params.max_resident_bytes, clusters.size());
+}
+
+std::shared_ptr<StreamedCluster> StreamedMesh::load_cluster(int id) const
+{
+    // ZoneScoped;
+    ClusterFileHeader header;
+    ClusterRecord record;
+    memcpy(&header, file.data(), sizeof(header));
+    memcpy(&record, file.data() + sizeof(header) + id * sizeof(ClusterRecord), sizeof(record));
+
+    std::shared_ptr<Mesh> mesh = std::make_shared<Mesh>();
+    mesh->shading_type = shading_type;
+    std::vector<LinearBVHNode> nodes;
+    std::vector<int> references;
+    // A corrupt cluster is left without a BVH, and so without faces, rather than indexing out of bounds while tracing
+    bool valid = read_mesh_bvh(file.data() + record.offset, cluster_layout(header, record), *mesh, nodes, references);
+
+    auto cluster = std::make_shared<StreamedCluster>();
+    cluster->mesh = mesh;
+    cluster->bytes = sizeof(StreamedCluster) + mesh->memory_usage();
+    if (!valid)
+    {
+        Console::GetInstance()->addErrorEntry("[error] Cluster " + std::to_string(id) + " of a streamed mesh is corrupt");
+        return cluster;
+    }
+
+    // The material of the faces is the one of the streamed mesh, see surface_interaction()
+    std::vector<std::shared_ptr<GeometricObject>> objects = {std::make_shared<TriangleMesh>(mesh, std::vector<std::shared_ptr<Material>>{material})};
+    cluster->bvh = std::make_shared<BVH>(objects, nodes, references, BVHBuildParams());
+    cluster->bytes += sizeof(TriangleMesh) + cluster->bvh->memory_usage();
+    return cluster;
+}
+
+ClusterCache::ClusterRef StreamedMesh::get_cluster(int id) const
+{
+    return cluster_cache->get(id, [this, id]()
+                              { return load_cluster(id); });
+}
+
+bool StreamedMesh::find_hit(const raytracer::Ray &ray, Interval t_range, PrimitiveHit &hit) const
+{
+    // Without a BVH over the clusters, test them one by one, skipping those whose bounds are missed
+    Ray tr = object_space_ray(ray);
+    Eigen::Vector3f inv_dir = tr.direction.cwiseInverse();
+    int dir_is_neg[3] = {inv_dir.x() < 0, inv_dir.y() < 0, inv_dir.z() < 0};
+    bool hit_anything = false;
+    for (int c = 0; c < (int)clusters.size(); c++)
+    {
+        if (hit_aabb(clusters[c].bounds, tr.origin, inv_dir, dir_is_neg, t_range) && find_primitive_hit(c, ray, t_range, hit))
+        {
+            t_range.max = hit.t;
+            hit_anything = true;
+        }
+    }
+    return hit_anything;
+}
+
+bool StreamedMesh::shadow_hit(const raytracer::Ray &ray, Interval t_range) const
+{
+    Ray tr = object_space_ray(ray);
+    Eigen::Vector3f inv_dir = tr.direction.cwiseInverse();
+    int dir_is_neg[3] = {inv_dir.x() < 0, inv_dir.y() < 0, inv_dir.z() < 0};
+    for (int c = 0; c < (int)clusters.size(); c++)
+    {
+        if (hit_aabb(clusters[c].bounds, tr.origin, inv_dir, dir_is_neg, t_range) && shadow_hit_primitive(c, ray, t_range))
+            return true;
+    }
+    return false;
+}
+
+void StreamedMesh::surface_interaction(const raytracer::Ray &ray, const PrimitiveHit &hit, HitInfo &rec) const
+{
+    // The cluster holding the face is the last one starting at or before it
+    auto it = std::upper_bound(clusters.begin(), clusters.end(), hit.index, [](int face, const ClusterInfo &cluster)
+                               { return face < cluster.first_face; });
+    int c = (it - clusters.begin()) - 1;
+    ClusterCache::ClusterRef cluster = get_cluster(c);
+
+    // The distance along the ray is the same in object space, the transform is affine
+    rec.p = ray.at(hit.t);
+    cluster->mesh->interpolate(hit.index - clusters[c].first_face, hit.beta, hit.gamma, rec);
+    if (this->transform != nullptr)
+        rec.normal = transform->transform_normal(rec.normal);
+    rec.material = this->material.get();
+}
+
+Eigen::AlignedBox3f StreamedMesh::bounding_box() const
+{
+    Eigen::AlignedBox3f bbox;
+    for (int c = 0; c < (int)clusters.size(); c++)
+        bbox.extend(primitive_bounding_box(c));
+    return bbox;
+}
+
+int StreamedMesh::primitive_count() const
+{
+    return clusters.size();
+}
+
+Eigen::AlignedBox3f StreamedMesh::primitive_bounding_box(int prim) const
+{
+    if (this->transform != nullptr)
+        return transform->transform_bounding_box(clusters[prim].bounds);
+    return clusters[prim].bounds;
+}
+
+Eigen::AlignedBox3f StreamedMesh::clipped_primitive_bounding_box(int prim, const Eigen::AlignedBox3f &box) const
+{
+    // Clipping the faces would mean loading the cluster while building
+    return primitive_bounding_box(prim).intersection(box);
+}
+
+bool StreamedMesh::find_primitive_hit(int prim, const raytracer::Ray &ray, Interval t_range, PrimitiveHit &hit) const
+{
+    if (ray.is_camera_ray && !this->visible_to_camera)
+        return false;
+
+    PrimitiveHit local;
+    ClusterCache::ClusterRef cluster = get_cluster(prim);
+    if (cluster->bvh == nullptr || !cluster->bvh->find_hit(object_space_ray(ray), t_range, local))
+        return false;
+
+    hit.record(this, local.t, local.beta, local.gamma, clusters[prim].first_face + local.index);
+    return true;
+}
+
+bool StreamedMesh::shadow_hit_primitive(int prim, const raytracer::Ray &ray, Interval t_range) const
+{
+    ClusterCache::ClusterRef cluster = get_cluster(prim);
+    return cluster->bvh != nullptr && cluster->bvh->shadow_hit(object_space_ray(ray), t_range);
+}
+
+static uint64_t cluster_file_key(const MappedFile &obj_file, int shape_index, ShadingType shading_type, const StreamingParams &params)
+{
+    uint64_t key = hash_bytes(obj_file.data(), obj_file.size());
+    key = hash_bytes(&cluster_file_version, sizeof(cluster_file_version), key);
+    key = hash_bytes(&shape_index, sizeof(shape_index), key);
+    int shading = shading_type;
+    key = hash_bytes(&shading, sizeof(shading), key);
+    return hash_bytes(&params.cluster_size, sizeof(params.cluster_size), key);
+}
+
+// Renumbers the indices of the corners of faces order[first, last) in one of the index streams of a mesh,
+// filling local_idx with the new indices and returning the old index of every new one
+static std::vector<int> renumber(const std::vector<int> &idx, const std::vector<int> &order, int first, int last, std::vector<int> &local_idx)
+{
+    std::vector<int> used;
+    used.reserve(3 * (last - first));
+    for (int i = first; i < last; i++)
+        used.insert(used.end(), &idx[3 * order[i]], &idx[3 * order[i]] + 3);
+    std::sort(used.begin(), used.end());
+    used.erase(std::unique(used.begin(), used.end()), used.end());
+
+    local_idx.resize(3 * (last - first));
+    for (size_t i = 0; i < local_idx.size(); i++)
+        local_idx[i] = std::lower_bound(used.begin(), used.end(), idx[3 * order[first + i / 3] + i % 3]) - used.begin();
+    return used;
+}
+
+// The faces order[first, last) of mesh as a cluster: their vertices renumbered, their BVH built and all of it serialized
+static std::vector<unsigned char> make_cluster(const Mesh &mesh, const std::vector<int> &order, int first, int last, ClusterRecord &record)
+{
+    Mesh local;
+    std::vector<int> used = renumber(mesh.vertex_idx, order, first, last, local.vertex_idx);
+    local.nr_vertices = used.size();
+    local.nr_triangles = last - first;
+    local.vertices = std::make_unique<Eigen::Vector3f[]>(local.nr_vertices);
+    for (int v = 0; v < local.nr_vertices; v++)
+        local.vertices[v] = mesh.vertices[used[v]];
+
+    local.has_normals = mesh.has_normals;
+    if (mesh.has_normals)
+    {
+        std::vector<int> used_normals = mesh.normal_idx.empty() ? used : renumber(mesh.normal_idx, order, first, last, local.normal_idx);
+        local.nr_normals = used_normals.size();
+        local.normals = std::make_unique<Eigen::Vector3f[]>(local.nr_normals);
+        for (int n = 0; n < local.nr_normals; n++)
+            local.normals[n] = mesh.normals[used_normals[n]];
+    }
+    local.has_uvs = mesh.has_uvs;
+    if (mesh.has_uvs)
+    {
+        std::vector<int> used_uvs = renumber(mesh.uv_idx, order, first, last, local.uv_idx);
+        local.nr_uvs = used_uvs.size();
+        local.uvs = std::make_unique<Eigen::Vector2f[]>(local.nr_uvs);
+        for (int t = 0; t < local.nr_uvs; t++)
+            local.uvs[t] = mesh.uvs[used_uvs[t]];
+    }
+
+    std::vector<Eigen::AlignedBox3f> prim_bounds(local.nr_triangles);
+    Eigen::AlignedBox3f bounds;
+    for (int f = 0; f < local.nr_triangles; f++)
+    {
+        prim_bounds[f] = local.face_bounding_box(f, nullptr);
+        bounds.extend(prim_bounds[f]);
+    }
+    std::vector<LinearBVHNode> nodes;
+    std::vector<int> references;
+    build_bvh(prim_bounds, BVHBuildParams(), nodes, references);
+
+    record.first_face = first;
+    record.nr_vertices = local.nr_vertices;
+    record.nr_triangles = local.nr_triangles;
+    record.nr_nodes = nodes.size();
+    record.nr_references = references.size();
+    record.nr_normals = local.nr_normals;
+    record.nr_uvs = local.nr_uvs;
+    for (int a = 0; a < 3; a++)
+    {
+        record.bounds[a] = bounds.min()[a];
+        record.bounds[a + 3] = bounds.max()[a];
+    }
+
+    std::vector<unsigned char> data;
+    data.reserve(MeshBVHLayout(local, nodes, references).payload_size());
+    write_mesh_bvh(local, nodes, references, [&data](const void *src, size_t bytes)
+                   {
+        const unsigned char *p = static_cast<const unsigned char *>(src);
+        data.insert(data.end(), p, p + bytes);
+        return true; });
+    return data;
+}
+
+static bool write_cluster_file(const std::string &path, uint64_t key, const Mesh &mesh, const StreamingParams &params)
+{
+    // ZoneScoped;
+    // Faces close along a Morton curve are close in space, so consecutive runs of the LBVH order make compact clusters
+    std::vector<Eigen::AlignedBox3f> face_bounds(mesh.nr_triangles);
+    ThreadPool *pool = ThreadPool::GetInstance();
+    pool->parallel_for(0, mesh.nr_triangles, 16384, [&](size_t f)
+                       { face_bounds[f] = mesh.face_bounding_box(f, nullptr); });
+    BVHBuildParams order_params;
+    order_params.method = LBVH;
+    std::vector<LinearBVHNode> order_nodes;
+    std::vector<int> order;
+    build_bvh(face_bounds, order_params, order_nodes, order);
+    order_nodes.clear();
+    face_bounds.clear();
+
+    int cluster_size = std::max(params.cluster_size, 1);
+    int nr_clusters = (mesh.nr_triangles + cluster_size - 1) / cluster_size;
+
+    ClusterFileHeader header = {};
+    memcpy(header.magic, cluster_file_magic, sizeof(cluster_file_magic));
+    header.version = cluster_file_version;
+    header.node_size = sizeof(LinearBVHNode);
+    header.key = key;
+    header.nr_clusters = nr_clusters;
+    header.shading_type = mesh.shading_type;
+    header.has_normals = mesh.has_normals;
+    header.has_uvs = mesh.has_uvs;
+    header.indexed_normals = !mesh.normal_idx.empty();
+
+    return write_file_atomically(path, [&](FILE *f)
+                                 {
+        // The table is written once all offsets are known
+        std::vector<ClusterRecord> table(nr_clusters);
+        bool ok = fwrite(&header, sizeof(header), 1, f) == 1;
+        ok = ok && fwrite(table.data(), sizeof(ClusterRecord), table.size(), f) == table.size();
+        uint64_t offset = sizeof(header) + table.size() * sizeof(ClusterRecord);
+
+        // Build a batch of clusters in parallel, then write it out, so only a batch is in memory at once
+        int batch_size = 4 * (pool->size() + 1);
+        std::vector<std::vector<unsigned char>> batch(batch_size);
+        for (int first = 0; first < nr_clusters && ok; first += batch_size)
+        {
+            int last = std::min(first + batch_size, nr_clusters);
+            pool->parallel_for(first, last, 1, [&](size_t c)
+                               { batch[c - first] = make_cluster(mesh, order, c * cluster_size, std::min((int)c * cluster_size + cluster_size, mesh.nr_triangles), table[c]); });
+            for (int c = first; c < last && ok; c++)
+            {
+                table[c].offset = offset;
+                ok = fwrite(batch[c - first].data(), 1, batch[c - first].size(), f) == batch[c - first].size();
+                offset += batch[c - first].size();
+                batch[c - first] = std::vector<unsigned char>();
+            }
+        }
+        ok = ok && fseek(f, sizeof(header), SEEK_SET) == 0;
+        return ok && fwrite(table.data(), sizeof(ClusterRecord), table.size(), f) == table.size(); });
+}
+
+std::shared_ptr<StreamedMesh> raytracer::load_streamed_mesh(const std::string &filename, int shape_index, ShadingType shading_type, std::shared_ptr<Material> mat,
+                                                            const StreamingParams &params, const std::string &cache_dir)
+{
+    HiResTimer timer;
+    timer.start();
+
+    MappedFile obj_file;
+    if (!obj_file.open(filename))
+    {
+        Console::GetInstance()->addErrorEntry("[error] Failed to open " + filename);
+        return nullptr;
+    }
+    uint64_t key = cluster_file_key(obj_file, shape_index, shading_type, params);
+    obj_file.close();
+
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.clusters", (unsigned long long)key);
+    std::string path = cache_dir + "/" + name;
+
+    auto streamed_mesh = std::make_shared<StreamedMesh>(path, key, mat, params);
+    if (!streamed_mesh->is_open())
+    {
+        tinyobj::attrib_t attrib;
+        std::vector<tinyobj::shape_t> shapes;
+        std::vector<tinyobj::material_t> materials;
+        if (!LoadObj(filename, attrib, shapes, materials) || shape_index < 0 || shape_index >= (int)shapes.size())
+            return nullptr;
+
+        std::shared_ptr<Mesh> mesh = load_mesh(attrib, shapes[shape_index], shading_type);
+        if (mesh->nr_triangles == 0)
+            return nullptr;
+        attrib = tinyobj::attrib_t();
+        shapes.clear();
+
+        make_directory(cache_dir);
+        if (!write_cluster_file(path, key, *mesh, params))
+        {
+            Console::GetInstance()->addErrorEntry("[error] Could not write the cluster file " + path);
+            return nullptr;
+        }
+        mesh.reset();
+
+        streamed_mesh = std::make_shared<StreamedMesh>(path, key, mat, params);
+        if (!streamed_mesh->is_open())
+            return nullptr;
+        Console::GetInstance()->addLogEntry("Saved the clusters of " + filename + " to " + path);
+    }
+
+    timer.stop();
+    Console::GetInstance()->addSuccesEntry("Opened " + filename + " as " + std::to_string(streamed_mesh->primitive_count()) + " streamed clusters in " +
+                                           std::to_string(timer.elapsed_time_milliseconds()) + " ms");
+    return streamed_mesh;
+}
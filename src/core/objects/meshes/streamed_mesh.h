@@ -0,0 +1,171 @@
+#pragma once
+#include <memory>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <cstdint>
+
+#include "geometric_object.h"
+#include "mesh.h"
+#include "bvh.h"
+#include "mapped_file.h"
+
+namespace raytracer
+{
+    struct StreamingParams
+    {
+        int cluster_size = 4096;                  // triangles per cluster, the unit that is loaded and evicted
+        size_t max_resident_bytes = 512ull << 20; // hard cap on the memory taken by the clusters in the cache
+    };
+
+    /*
+     *  A part of a streamed mesh that is close together in space: its own vertices, faces and BVH.
+     */
+    struct StreamedCluster
+    {
+        std::shared_ptr<Mesh> mesh;
+        std::shared_ptr<BVH> bvh; // null if the cluster in the file is corrupt
+        size_t bytes = 0;
+    };
+
+    struct ClusterCacheStatistics
+    {
+        uint64_t hits = 0, misses = 0, evictions = 0;
+        size_t resident_bytes = 0, peak_resident_bytes = 0;
+        int resident_clusters = 0;
+    };
+
+    /*
+     *  The clusters currently in memory, approximately least recently used evicted first. Loading a cluster
+     *  evicts others until it fits under max_bytes, so only a cluster bigger than the whole cache can exceed it.
+     *  A resident cluster is found without locking: every cluster has a slot holding it, and a thread pins the
+     *  current epoch while it uses what it found there. An evicted cluster is only freed once no thread is
+     *  still pinned at an epoch from before its eviction. The lock is only taken to load and evict.
+     *  Safe to use from several render threads.
+     */
+    class ClusterCache
+    {
+    public:
+        ClusterCache(size_t max_bytes, int nr_clusters);
+
+        /*
+         *  A cluster in use by the thread that got it, which can't be freed before this is destroyed.
+         *  Keep it on the stack for as long as the cluster is traced.
+         */
+        class ClusterRef
+        {
+        public:
+            explicit ClusterRef(const StreamedCluster *cluster) : cluster(cluster) {}
+            ClusterRef(ClusterRef &&other) : cluster(other.cluster) { other.cluster = nullptr; }
+            ClusterRef(const ClusterRef &) = delete;
+            ClusterRef &operator=(const ClusterRef &) = delete;
+            ~ClusterRef();
+
+            const StreamedCluster *operator->() const { return cluster; }
+
+        private:
+            const StreamedCluster *cluster;
+        };
+
+        // The cluster with the given id, calling load to read it if it isn't resident
+        ClusterRef get(int id, const std::function<std::shared_ptr<StreamedCluster>()> &load);
+
+        ClusterCacheStatistics statistics() const;
+
+        // Writes the hit, miss and eviction counters to the console, to help size the cache
+        void log_statistics(const std::string &name) const;
+
+    private:
+        struct Slot
+        {
+            std::atomic<const StreamedCluster *> cluster{nullptr};
+            std::atomic<uint64_t> last_used{0}; // the miss clock when last found, only written when it changes
+        };
+
+        // Hits are counted by thread in counters padded to a cache line, so threads don't keep writing to the same one
+        struct HitCounter
+        {
+            std::atomic<uint64_t> hits{0};
+            char pad[56];
+        };
+        static const int nr_hit_counters = 64;
+
+        struct Retired
+        {
+            std::shared_ptr<const StreamedCluster> cluster;
+            uint64_t epoch; // threads pinned at this epoch or before may still be using it
+        };
+
+        size_t max_bytes;
+        std::unique_ptr<Slot[]> slots;
+        HitCounter hit_counters[nr_hit_counters];
+        std::atomic<uint64_t> miss_clock{0}; // advanced by every miss, the unit of the recency of the clusters
+
+        // Owned by the lock
+        mutable std::mutex mutex;
+        std::vector<std::shared_ptr<const StreamedCluster>> owners; // keeps the cluster in every slot alive
+        std::vector<int> resident;
+        std::vector<Retired> retired;
+        ClusterCacheStatistics stats;
+
+        void evict(int id);
+
+        // Moves the evicted clusters no thread can be using anymore to freed, to be released after unlocking
+        void take_unused_retired(std::vector<std::shared_ptr<const StreamedCluster>> &freed);
+    };
+
+    /*
+     *  A triangle mesh kept on disk, split into spatial clusters of which only the recently used ones
+     *  are in memory. A BVH built over it holds the clusters in its leaves (see primitive_count()),
+     *  and every cluster has a BVH of its own, loaded along with it. What stays resident is just the
+     *  table of the clusters, with their bounds and where they are in the file.
+     */
+    class StreamedMesh : public GeometricObject
+    {
+    public:
+        // Opens a cluster file written by load_streamed_mesh(). Check is_open() afterwards.
+        StreamedMesh(const std::string &cluster_file, uint64_t key, std::shared_ptr<Material> mat, const StreamingParams &params);
+
+        bool is_open() const { return !clusters.empty(); }
+
+        bool find_hit(const raytracer::Ray &r, Interval t_range, PrimitiveHit &hit) const override;
+        bool shadow_hit(const raytracer::Ray &r, Interval t_range) const override;
+        void surface_interaction(const raytracer::Ray &r, const PrimitiveHit &hit, HitInfo &rec) const override;
+        Eigen::AlignedBox3f bounding_box() const override;
+
+        int primitive_count() const override;
+        Eigen::AlignedBox3f primitive_bounding_box(int prim) const override;
+        Eigen::AlignedBox3f clipped_primitive_bounding_box(int prim, const Eigen::AlignedBox3f &box) const override;
+        bool find_primitive_hit(int prim, const raytracer::Ray &r, Interval t_range, PrimitiveHit &hit) const override;
+        bool shadow_hit_primitive(int prim, const raytracer::Ray &r, Interval t_range) const override;
+
+        // The cache of the clusters, only there once the mesh is open
+        const ClusterCache &cache() const { return *cluster_cache; }
+
+    private:
+        struct ClusterInfo
+        {
+            Eigen::AlignedBox3f bounds;
+            int first_face; // hits record the face index first_face + the face within the cluster
+        };
+
+        MappedFile file;
+        std::vector<ClusterInfo> clusters;
+        std::unique_ptr<ClusterCache> cluster_cache;
+        ShadingType shading_type;
+
+        std::shared_ptr<StreamedCluster> load_cluster(int id) const;
+        ClusterCache::ClusterRef get_cluster(int id) const;
+    };
+
+    /*
+     *  Loads one shape of an .obj file as a StreamedMesh. The clusters are written to a file in cache_dir
+     *  named after a hash of the .obj contents, the shape, the shading type and the cluster size; once
+     *  it exists, the .obj isn't read again. Making the file still loads the whole shape once.
+     *  Returns nullptr if the model can't be loaded.
+     */
+    std::shared_ptr<StreamedMesh> load_streamed_mesh(const std::string &filename, int shape_index, ShadingType shading_type, std::shared_ptr<Material> mat,
+                                                     const StreamingParams &params = StreamingParams(), const std::string &cache_dir = "../cache");
+}
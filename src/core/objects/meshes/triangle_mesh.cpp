@@ -0,0 +1,133 @@
+#include "triangle_mesh.h"
+using namespace raytracer;
+
+TriangleMesh::TriangleMesh(const std::shared_ptr<Mesh> &mesh, const std::vector<std::shared_ptr<Material>> &materials,
+                           const std::vector<uint16_t> &face_materials)
+{
+    assert(!materials.empty());
+    assert(face_materials.empty() || face_materials.size() == (size_t)mesh->nr_triangles);
+    this->mesh = mesh;
+    this->materials = materials;
+    this->face_materials = face_materials;
+    this->material = materials[0];
+}
+
+bool TriangleMesh::find_hit(const raytracer::Ray &ray, Interval t_range, PrimitiveHit &hit) const
+{
+    if (ray.is_camera_ray && !this->visible_to_camera)
+        return false;
+
+    Ray tr = object_space_ray(ray);
+    bool hit_anything = false;
+    float t, beta, gamma;
+    for (int f = 0; f < mesh->nr_triangles; f++)
+    {
+        if (mesh->intersect_face(f, tr, t_range, t, beta, gamma))
+        {
+            hit.record(this, t, beta, gamma, f);
+            t_range.max = t;
+            hit_anything = true;
+        }
+    }
+    return hit_anything;
+}
+
+bool TriangleMesh::shadow_hit(const raytracer::Ray &ray, Interval t_range) const
+{
+    Ray tr = object_space_ray(ray);
+    float t, beta, gamma;
+    for (int f = 0; f < mesh->nr_triangles; f++)
+    {
+        if (mesh->intersect_face(f, tr, t_range, t, beta, gamma))
+            return true;
+    }
+    return false;
+}
+
+void TriangleMesh::surface_interaction(const raytracer::Ray &ray, const PrimitiveHit &hit, HitInfo &rec) const
+{
+    // The distance along the ray is the same in object space, the transform is affine
+    rec.p = ray.at(hit.t);
+    mesh->interpolate(hit.index, hit.beta, hit.gamma, rec);
+    if (this->transform != nullptr)
+        rec.normal = transform->transform_normal(rec.normal);
+
+    rec.material = face_materials.empty() ? materials[0].get() : materials[face_materials[hit.index]].get();
+}
+
+Eigen::AlignedBox3f TriangleMesh::bounding_box() const
+{
+    Eigen::AlignedBox3f bbox;
+    for (int f = 0; f < mesh->nr_triangles; f++)
+        bbox.extend(mesh->face_bounding_box(f, this->transform));
+    return bbox;
+}
+
+int TriangleMesh::primitive_count() const
+{
+    return mesh->nr_triangles;
+}
+
+Eigen::AlignedBox3f TriangleMesh::primitive_bounding_box(int prim) const
+{
+    return mesh->face_bounding_box(prim, this->transform);
+}
+
+Eigen::AlignedBox3f TriangleMesh::clipped_primitive_bounding_box(int prim, const Eigen::AlignedBox3f &box) const
+{
+    return mesh->clipped_face_bounding_box(prim, this->transform, box);
+}
+
+bool TriangleMesh::find_primitive_hit(int prim, const raytracer::Ray &ray, Interval t_range, PrimitiveHit &hit) const
+{
+    if (ray.is_camera_ray && !this->visible_to_camera)
+        return false;
+
+    float t, beta, gamma;
+    if (!mesh->intersect_face(prim, object_space_ray(ray), t_range, t, beta, gamma))
+        return false;
+
+    hit.record(this, t, beta, gamma, prim);
+    return true;
+}
+
+bool TriangleMesh::shadow_hit_primitive(int prim, const raytracer::Ray &ray, Interval t_range) const
+{
+    float t, beta, gamma;
+    return mesh->intersect_face(prim, object_space_ray(ray), t_range, t, beta, gamma);
+}
+
+bool TriangleMesh::triangle_vertices(int prim, Eigen::Vector3f vertices[3]) const
+{
+    mesh->face_vertices(prim, this->transform, vertices);
+    return true;
+}
+
+std::shared_ptr<TriangleMesh> raytracer::load_triangle_mesh(const tinyobj::attrib_t &attrib, const tinyobj::shape_t &shape, ShadingType shading_type,
+                                                            const std::vector<std::shared_ptr<Material>> &materials, Transform *t, bool compact)
+{
+    // ZoneScoped;
+    std::shared_ptr<Mesh> mesh = load_mesh(attrib, shape, shading_type);
+    if (compact)
+        mesh->compress();
+
+    // Material ids are only kept if some face uses something other than the first material
+    std::vector<uint16_t> face_materials;
+    bool uses_others = false;
+    for (int id : shape.mesh.material_ids)
+        uses_others |= id > 0 && id < (int)materials.size();
+    if (uses_others)
+    {
+        face_materials.resize(mesh->nr_triangles, 0);
+        for (size_t f = 0; f < face_materials.size() && f < shape.mesh.material_ids.size(); f++)
+        {
+            int id = shape.mesh.material_ids[f];
+            if (id >= 0 && id < (int)materials.size())
+                face_materials[f] = id;
+        }
+    }
+
+    auto triangle_mesh = std::make_shared<TriangleMesh>(mesh, materials, face_materials);
+    triangle_mesh->set_transform(t);
+    return triangle_mesh;
+}
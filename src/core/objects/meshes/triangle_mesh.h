@@ -0,0 +1,50 @@
+#pragma once
+#include <memory>
+#include <vector>
+#include <cstdint>
+
+#include "geometric_object.h"
+#include "mesh.h"
+
+namespace raytracer
+{
+    /*
+     *  A whole triangle mesh as a single object: the faces are only indices into the mesh's flat
+     *  arrays, with a material id each, instead of one heap allocated MeshTriangle per face.
+     *  A BVH built over it sorts and intersects the faces one by one (see primitive_count()),
+     *  which is how it should be traced; on its own, find_hit() tests every face.
+     */
+    class TriangleMesh : public GeometricObject
+    {
+    public:
+        // face_materials holds an index into materials per face, or is empty if every face uses materials[0]
+        TriangleMesh(const std::shared_ptr<Mesh> &mesh, const std::vector<std::shared_ptr<Material>> &materials,
+                     const std::vector<uint16_t> &face_materials = std::vector<uint16_t>());
+
+        bool find_hit(const raytracer::Ray &r, Interval t_range, PrimitiveHit &hit) const override;
+        bool shadow_hit(const raytracer::Ray &r, Interval t_range) const override;
+        void surface_interaction(const raytracer::Ray &r, const PrimitiveHit &hit, HitInfo &rec) const override;
+        Eigen::AlignedBox3f bounding_box() const override;
+
+        int primitive_count() const override;
+        Eigen::AlignedBox3f primitive_bounding_box(int prim) const override;
+        Eigen::AlignedBox3f clipped_primitive_bounding_box(int prim, const Eigen::AlignedBox3f &box) const override;
+        bool find_primitive_hit(int prim, const raytracer::Ray &r, Interval t_range, PrimitiveHit &hit) const override;
+        bool shadow_hit_primitive(int prim, const raytracer::Ray &r, Interval t_range) const override;
+        bool triangle_vertices(int prim, Eigen::Vector3f vertices[3]) const override;
+
+    public:
+        std::shared_ptr<Mesh> mesh;
+        std::vector<std::shared_ptr<Material>> materials;
+        std::vector<uint16_t> face_materials;
+    };
+
+    /*
+     *  One shape of an .obj file as a TriangleMesh. The faces take their material from the shape's
+     *  material ids, indexing materials; faces without a valid id use materials[0].
+     *  compact keeps the vertex data compressed (see Mesh::compress()), for meshes too large to hold
+     *  at full precision; pair it with BVHBuildParams::compact.
+     */
+    std::shared_ptr<TriangleMesh> load_triangle_mesh(const tinyobj::attrib_t &attrib, const tinyobj::shape_t &shape, ShadingType shading_type,
+                                                     const std::vector<std::shared_ptr<Material>> &materials, Transform *t, bool compact = false);
+}
@@ -1,5 +1,5 @@
 #include "rectangle.h"
-#include "multijittered.h"
+#include "sobol_sampler.h"
 using namespace raytracer;
 
 Rectangle::Rectangle(const Eigen::Vector3f &p0, const Eigen::Vector3f &a, const Eigen::Vector3f &b, std::shared_ptr<raytracer::Material> mat)
@@ -9,7 +9,7 @@ Rectangle::Rectangle(const Eigen::Vector3f &p0, const Eigen::Vector3f &a, const
     this->b = b;
     this->normal = (a.cross(b)).normalized();
     this->material = mat;
-    sampler = std::make_shared<MultiJittered>(20);
+    sampler = std::make_shared<SobolSampler>();
     this->a_len_sq = a.squaredNorm();
     this->b_len_sq = b.squaredNorm();
     this->area = a.norm() * b.norm();
@@ -25,7 +25,7 @@ Rectangle::Rectangle(const Eigen::Vector3f &p0, const Eigen::Vector3f &a, const
     this->b = b;
     this->normal = normal.normalized();
     this->material = mat;
-    sampler = std::make_shared<MultiJittered>(20);
+    sampler = std::make_shared<SobolSampler>();
     this->a_len_sq = a.squaredNorm();
     this->b_len_sq = b.squaredNorm();
     this->area = a.norm() * b.norm();
@@ -34,31 +34,45 @@ Rectangle::Rectangle(const Eigen::Vector3f &p0, const Eigen::Vector3f &a, const
     aabb = compute_aabb(p0, a, b);
 }
 
-bool Rectangle::hit(const raytracer::Ray &r, Interval t_range, HitInfo &rec) const
+bool Rectangle::find_hit(const raytracer::Ray &r, Interval t_range, PrimitiveHit &hit) const
 {
     if (r.is_camera_ray && !this->visible_to_camera)
         return false;
 
-    bool transformed = this->transform != nullptr;
+    float t;
+    if (!intersect(object_space_ray(r), t_range, t))
+        return false;
 
-    Ray tr;
-    tr.origin = r.origin;
-    tr.direction = r.direction;
-    if (transformed)
-    {
-        tr.origin = Transform::Inverse(*transform).transform_point(r.origin);
-        tr.direction = Transform::Inverse(*transform).transform_vector(r.direction);
-    }
+    hit.record(this, t);
+    return true;
+}
 
-    float t = (p0 - tr.origin).dot(normal) / tr.direction.dot(normal);
+void Rectangle::surface_interaction(const raytracer::Ray &r, const PrimitiveHit &hit, HitInfo &rec) const
+{
+    rec.p = r.at(hit.t);
+    rec.normal = normal;
+    rec.material = material.get();
+
+    if (this->transform != nullptr)
+        rec.normal = transform->transform_normal(rec.normal);
+}
+
+bool Rectangle::shadow_hit(const raytracer::Ray &r, Interval t_range) const
+{
+    float t;
+    return intersect(object_space_ray(r), t_range, t);
+}
+
+bool Rectangle::intersect(const raytracer::Ray &tr, Interval t_range, float &t) const
+{
+    t = (p0 - tr.origin).dot(normal) / tr.direction.dot(normal);
 
     if (t < t_range.min || t > t_range.max)
     {
         return false;
     }
 
-    Eigen::Vector3f p = tr.origin + t * tr.direction;
-    Eigen::Vector3f d = p - p0;
+    Eigen::Vector3f d = tr.origin + t * tr.direction - p0;
 
     float ddota = d.dot(a);
 
@@ -73,24 +87,12 @@ bool Rectangle::hit(const raytracer::Ray &r, Interval t_range, HitInfo &rec) con
     {
         return false;
     }
-
-    rec.t = t;
-    rec.normal = normal;
-    rec.p = p;
-    rec.material = material;
-
-    if (transformed)
-    {
-        rec.p = transform->transform_point(rec.p);
-        rec.normal = transform->transform_normal(rec.normal);
-    }
-
     return true;
 }
 
 Eigen::Vector3f Rectangle::sample() const
 {
-    Eigen::Vector2f sample_point = Eigen::Vector2f(random_float(), random_float()); // sampler->sample_unit_square();
+    Eigen::Vector2f sample_point = sampler->sample_unit_square();
     return p0 + sample_point.x() * a + sample_point.y() * b;
 }
 
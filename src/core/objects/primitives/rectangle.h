@@ -20,7 +20,11 @@ namespace raytracer
         
         Rectangle(const Eigen::Vector3f &p0, const Eigen::Vector3f &a, const Eigen::Vector3f &b, const Eigen::Vector3f normal, std::shared_ptr<raytracer::Material> mat);
 
-        bool hit(const raytracer::Ray &r, Interval t_range, HitInfo &rec) const;
+        bool find_hit(const raytracer::Ray &r, Interval t_range, PrimitiveHit &hit) const override;
+
+        void surface_interaction(const raytracer::Ray &r, const PrimitiveHit &hit, HitInfo &rec) const override;
+
+        bool shadow_hit(const raytracer::Ray &r, Interval t_range) const override;
 
         Eigen::AlignedBox3f bounding_box() const override;
 
@@ -31,6 +35,10 @@ namespace raytracer
         float pdf_solid_angle(const HitInfo &rec, const Eigen::Vector3f &wi) const override;
         
         Eigen::Vector3f get_normal(const Eigen::Vector3f p) const override;
+
+    private:
+        // Intersects a ray given in object space, returning the distance
+        bool intersect(const raytracer::Ray &tr, Interval t_range, float &t) const;
     };
 
     std::vector<std::shared_ptr<GeometricObject>> create_box(float width, float height, float depth, std::shared_ptr<Material> mat, Transform *t);
@@ -20,24 +20,49 @@ Sphere::Sphere(const Eigen::Vector3f &c, float r, std::shared_ptr<raytracer::Mat
     aabb = Eigen::AlignedBox3f(center - rvec, center + rvec);
 }
 
-bool Sphere::hit(const raytracer::Ray &r, Interval t_range, HitInfo &rec) const
+bool Sphere::find_hit(const raytracer::Ray &r, Interval t_range, PrimitiveHit &hit) const
 {
     if (r.is_camera_ray && !this->visible_to_camera)
         return false;
 
-    bool transformed = this->transform != nullptr;
+    float root;
+    if (!intersect(object_space_ray(r), t_range, root))
+        return false;
 
-    Ray tr;
-    tr.origin = r.origin;
-    tr.direction = r.direction;
-    if (transformed)
+    hit.record(this, root);
+    return true;
+}
+
+void Sphere::surface_interaction(const raytracer::Ray &r, const PrimitiveHit &hit, HitInfo &rec) const
+{
+    Ray tr = object_space_ray(r);
+    rec.p = tr.at(hit.t);
+    rec.material = this->material.get();
+
+    Eigen::Vector3f outward_normal = (rec.p - center) / radius;
+    rec.set_face_normal(tr, outward_normal);
+
+    if (this->transform != nullptr)
     {
-        tr.origin = Transform::Inverse(*transform).transform_point(r.origin);
-        tr.direction = Transform::Inverse(*transform).transform_vector(r.direction);
+        rec.p = transform->transform_point(rec.p);
+        rec.normal = transform->transform_normal(rec.normal);
     }
 
-    float t_min = t_range.min;
-    float t_max = t_range.max;
+    float theta = acos(-rec.normal.y());
+    float phi = atan2(-rec.normal.z(), rec.normal.x()) + pi;
+
+    rec.u = phi / (2 * pi);
+    rec.v = theta / pi;
+}
+
+bool Sphere::shadow_hit(const raytracer::Ray &r, Interval t_range) const
+{
+    float t;
+    return intersect(object_space_ray(r), t_range, t);
+}
+
+bool Sphere::intersect(const raytracer::Ray &tr, Interval t_range, float &t) const
+{
     Eigen::Vector3f oc = tr.origin - center;
     auto a = tr.direction.squaredNorm();
     auto half_b = oc.dot(tr.direction);
@@ -48,35 +73,13 @@ bool Sphere::hit(const raytracer::Ray &r, Interval t_range, HitInfo &rec) const
         return false;
     auto sqrtd = sqrt(discriminant);
 
-    auto root = (-half_b - sqrtd) / a;
-    if (root < t_min || t_max < root)
+    t = (-half_b - sqrtd) / a;
+    if (t < t_range.min || t_range.max < t)
     {
-        root = (-half_b + sqrtd) / a;
-        if (root < t_min || t_max < root)
+        t = (-half_b + sqrtd) / a;
+        if (t < t_range.min || t_range.max < t)
             return false;
     }
-    Eigen::Vector3f n = (rec.p - center) / radius;
-    rec.t = root;
-    rec.p = tr.at(rec.t);
-    rec.normal = n;
-    rec.material = this->material;
-
-    Eigen::Vector3f outward_normal = n;
-    rec.set_face_normal(tr, outward_normal);
-
-    if (transformed)
-    {
-        rec.p = transform->transform_point(rec.p);
-        rec.normal = transform->transform_normal(rec.normal);
-    }
-
-    float theta = acos(-rec.normal.y());
-    float phi = atan2(-rec.normal.z(), rec.normal.x()) + pi;
-
-    rec.u = phi / (2 * pi);
-    rec.v = theta / pi;
-    // std::cout << theta << " " << phi << " " << rec.u << " " << rec.v << "\n";
-
     return true;
 }
 
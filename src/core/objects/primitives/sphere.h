@@ -14,9 +14,17 @@ namespace raytracer
 
         Sphere(const Eigen::Vector3f &c, float r, std::shared_ptr<raytracer::Material> mat);
 
-        bool hit(const raytracer::Ray &r, Interval t_range, HitInfo &rec) const;
+        bool find_hit(const raytracer::Ray &r, Interval t_range, PrimitiveHit &hit) const override;
+
+        void surface_interaction(const raytracer::Ray &r, const PrimitiveHit &hit, HitInfo &rec) const override;
+
+        bool shadow_hit(const raytracer::Ray &r, Interval t_range) const override;
 
         Eigen::AlignedBox3f bounding_box() const override;
+
+    private:
+        // Finds the nearest root in t_range of a ray given in object space
+        bool intersect(const raytracer::Ray &tr, Interval t_range, float &t) const;
     };
 
 }
\ No newline at end of file
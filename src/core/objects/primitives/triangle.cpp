@@ -22,55 +22,58 @@ Triangle::Triangle(const Eigen::Vector3f &a, const Eigen::Vector3f &b, const Eig
     aabb.extend(v2 + Eigen::Vector3f(0.0001, 0.0001, 0.0001));
 }
 
-bool Triangle::hit(const raytracer::Ray &ray, Interval t_range, HitInfo &rec) const
+bool Triangle::find_hit(const raytracer::Ray &ray, Interval t_range, PrimitiveHit &hit) const
 {
     if (ray.is_camera_ray && !this->visible_to_camera) return false;
 
-    float a = v0.x() - v1.x(), b = v0.x() - v2.x(), c = ray.direction.x(), d = v0.x() - ray.origin.x();
-    float e = v0.y() - v1.y(), f = v0.y() - v2.y(), g = ray.direction.y(), h = v0.y() - ray.origin.y();
-    float i = v0.z() - v1.z(), j = v0.z() - v2.z(), k = ray.direction.z(), l = v0.z() - ray.origin.z();
-
-    float m = f * k - g * j, n = h * k - g * l, p = f * l - h * j;
-    float q = g * i - e * k, s = e * j - f * i;
-
-    float inv_denom = 1.0 / (a * m + b * q + c * s);
-
-    float e1 = d * m - b * n - c * p;
-    float beta = e1 * inv_denom;
-
-    if (beta < 0.0)
-    {
+    float t;
+    if (!intersect(ray, t_range, t))
         return false;
-    }
 
-    float r = e * l - h * i;
-    float e2 = a * n + d * q + c * r;
-    float gamma = e2 * inv_denom;
+    hit.record(this, t);
+    return true;
+}
 
-    if (gamma < 0.0)
-    {
-        return false;
-    }
+bool Triangle::triangle_vertices(int prim, Eigen::Vector3f vertices[3]) const
+{
+    vertices[0] = v0;
+    vertices[1] = v1;
+    vertices[2] = v2;
+    return true;
+}
 
-    if (beta + gamma > 1.0)
-    {
-        return false;
-    }
+void Triangle::surface_interaction(const raytracer::Ray &ray, const PrimitiveHit &hit, HitInfo &rec) const
+{
+    rec.normal = normal;
+    rec.p = ray.at(hit.t);
+    rec.material = this->material.get();
+}
 
-    float e3 = a * p - b * r + d * s;
-    float t = e3 * inv_denom;
+bool Triangle::shadow_hit(const raytracer::Ray &ray, Interval t_range) const
+{
+    float t;
+    return intersect(ray, t_range, t);
+}
 
-    if (t < std::numeric_limits<float>::epsilon())
-    {
+bool Triangle::intersect(const raytracer::Ray &ray, Interval t_range, float &t) const
+{
+    // Möller–Trumbore, the same test the BVH runs on blocks of triangles
+    Eigen::Vector3f e1 = v1 - v0, e2 = v2 - v0;
+    Eigen::Vector3f pvec = ray.direction.cross(e2);
+    float inv_det = 1.0f / e1.dot(pvec);
+
+    Eigen::Vector3f tvec = ray.origin - v0;
+    float beta = tvec.dot(pvec) * inv_det;
+    if (beta < 0.0f)
         return false;
-    }
 
-    rec.t = t;
-    rec.normal = normal;
-    rec.p = ray.origin + t * ray.direction;
-    rec.material = this->material;
+    Eigen::Vector3f qvec = tvec.cross(e1);
+    float gamma = ray.direction.dot(qvec) * inv_det;
+    if (gamma < 0.0f || beta + gamma > 1.0f)
+        return false;
 
-    return true;
+    t = e2.dot(qvec) * inv_det;
+    return t >= t_range.min && t <= t_range.max;
 }
 
 Eigen::AlignedBox3f Triangle::bounding_box() const
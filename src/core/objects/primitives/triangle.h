@@ -15,9 +15,18 @@ namespace raytracer
 
         Triangle(const Eigen::Vector3f &a, const Eigen::Vector3f &b, const Eigen::Vector3f &c, std::shared_ptr<Material> mat);
 
-        bool hit(const raytracer::Ray &r, Interval t_range, HitInfo &rec) const override;
+        bool find_hit(const raytracer::Ray &r, Interval t_range, PrimitiveHit &hit) const override;
+
+        bool shadow_hit(const raytracer::Ray &r, Interval t_range) const override;
 
         Eigen::AlignedBox3f bounding_box() const override;
+
+        bool triangle_vertices(int prim, Eigen::Vector3f vertices[3]) const override;
+
+        void surface_interaction(const raytracer::Ray &r, const PrimitiveHit &hit, HitInfo &rec) const override;
+
+    private:
+        bool intersect(const raytracer::Ray &ray, Interval t_range, float &t) const;
     };
 
     // std::vector<std::shared_ptr<Triangle>> tessellate_flat_sphere(const int horizontal_steps, const int vertical_steps, std::shared_ptr<Material> mat);
@@ -0,0 +1,158 @@
+#pragma once
+#include "ray.h"
+#include "interval.h"
+#include "wide_bvh.h"
+
+namespace raytracer
+{
+    /*
+     *  A group of up to max_size coherent rays (e.g. the camera rays of neighbouring pixels)
+     *  that are traced through the BVH together. Every ray is a SIMD lane of the box tests,
+     *  so a node is fetched and tested once for the whole packet. The ray data is stored
+     *  in SoA layout for that; sets of rays are passed around as bit masks of lanes.
+     */
+    struct RayPacket
+    {
+        static const int max_size = 16;
+
+        int size = 0;
+        float t_min = 0.0f; // shared by all the rays
+        Ray rays[max_size];
+        alignas(32) float origin[3][max_size];
+        alignas(32) float inv_dir[3][max_size];
+        alignas(32) float t_max[max_size]; // shortened as closer hits are found
+
+        RayPacket()
+        {
+            // Unused lanes get an empty interval, so they never hit anything
+            for (int i = 0; i < max_size; i++)
+            {
+                t_max[i] = -infinity;
+                for (int a = 0; a < 3; a++)
+                {
+                    origin[a][i] = 0.0f;
+                    inv_dir[a][i] = 0.0f;
+                }
+            }
+        }
+
+        // Returns the lane of the ray, or -1 if the packet is full
+        int add(const Ray &r, Interval ray_t)
+        {
+            if (size == max_size)
+                return -1;
+            t_min = ray_t.min;
+            rays[size] = r;
+            t_max[size] = ray_t.max;
+            for (int a = 0; a < 3; a++)
+            {
+                origin[a][size] = r.origin[a];
+                inv_dir[a][size] = 1.0f / r.direction[a];
+            }
+            return size++;
+        }
+
+        int all_lanes() const { return (1 << size) - 1; }
+    };
+
+    /*
+     *  Tests the box against the active rays of the packet.
+     *  Returns the mask of the active lanes whose ray hits the box within its [t_min, t_max].
+     *  Like hit_aabb(), every lane takes its entry and exit plane by the sign of its direction and
+     *  ignores a plane giving NaN (a ray parallel to it starting on it), so the lanes agree with
+     *  single ray traversal.
+     */
+    inline int intersect_packet(const Eigen::AlignedBox3f &box, const RayPacket &packet, int active)
+    {
+        int mask = 0;
+#if RT_BVH_WIDTH == 8
+        for (int c = 0; c < packet.size; c += 8)
+        {
+            if (((active >> c) & 0xff) == 0)
+                continue;
+            __m256 t_near = _mm256_set1_ps(packet.t_min);
+            __m256 t_far = _mm256_load_ps(&packet.t_max[c]);
+            for (int a = 0; a < 3; a++)
+            {
+                __m256 o = _mm256_load_ps(&packet.origin[a][c]);
+                __m256 inv_d = _mm256_load_ps(&packet.inv_dir[a][c]);
+                __m256 t0 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(box.min()[a]), o), inv_d);
+                __m256 t1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(box.max()[a]), o), inv_d);
+                __m256 neg = _mm256_cmp_ps(inv_d, _mm256_setzero_ps(), _CMP_LT_OQ);
+                t_near = _mm256_max_ps(_mm256_blendv_ps(t0, t1, neg), t_near);
+                t_far = _mm256_min_ps(_mm256_blendv_ps(t1, t0, neg), t_far);
+            }
+            mask |= _mm256_movemask_ps(_mm256_cmp_ps(t_near, t_far, _CMP_LE_OQ)) << c;
+        }
+#elif RT_BVH_WIDTH == 4
+        for (int c = 0; c < packet.size; c += 4)
+        {
+            if (((active >> c) & 0xf) == 0)
+                continue;
+            __m128 t_near = _mm_set1_ps(packet.t_min);
+            __m128 t_far = _mm_load_ps(&packet.t_max[c]);
+            for (int a = 0; a < 3; a++)
+            {
+                __m128 o = _mm_load_ps(&packet.origin[a][c]);
+                __m128 inv_d = _mm_load_ps(&packet.inv_dir[a][c]);
+                __m128 t0 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(box.min()[a]), o), inv_d);
+                __m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(box.max()[a]), o), inv_d);
+                __m128 neg = _mm_cmplt_ps(inv_d, _mm_setzero_ps());
+                __m128 entry = _mm_or_ps(_mm_and_ps(neg, t1), _mm_andnot_ps(neg, t0));
+                __m128 exit = _mm_or_ps(_mm_and_ps(neg, t0), _mm_andnot_ps(neg, t1));
+                t_near = _mm_max_ps(entry, t_near);
+                t_far = _mm_min_ps(exit, t_far);
+            }
+            mask |= _mm_movemask_ps(_mm_cmple_ps(t_near, t_far)) << c;
+        }
+#else
+        for (int i = 0; i < packet.size; i++)
+        {
+            float t_near = packet.t_min, t_far = packet.t_max[i];
+            for (int a = 0; a < 3; a++)
+            {
+                bool neg = packet.inv_dir[a][i] < 0;
+                float t0 = ((neg ? box.max() : box.min())[a] - packet.origin[a][i]) * packet.inv_dir[a][i];
+                float t1 = ((neg ? box.min() : box.max())[a] - packet.origin[a][i]) * packet.inv_dir[a][i];
+                if (t0 > t_near)
+                    t_near = t0;
+                if (t1 < t_far)
+                    t_far = t1;
+            }
+            if (t_near <= t_far)
+                mask |= 1 << i;
+        }
+#endif
+        return mask & active;
+    }
+
+#if RT_BVH_WIDTH > 2
+    /*
+     *  Tests every child box of a compact node against the active rays of the packet, writing the lanes
+     *  that hit child i to masks[i]. Returns the mask of the children hit by any lane. The planes are
+     *  decoded as in intersect_children(): q * 2^e is exact, so origin + q * 2^e rounds the same way.
+     */
+    inline int intersect_children_packet(const CompactWideBVHNode &node, const RayPacket &packet, int active, int *masks)
+    {
+        float scale[3];
+        for (int a = 0; a < 3; a++)
+            scale[a] = exp2_int(node.exponent[a]);
+
+        int hit_children = 0;
+        for (int valid = node.valid; valid != 0; valid &= valid - 1)
+        {
+            int i = __builtin_ctz(valid);
+            Eigen::AlignedBox3f box;
+            for (int a = 0; a < 3; a++)
+            {
+                box.min()[a] = node.origin[a] + node.bounds[a][i] * scale[a];
+                box.max()[a] = node.origin[a] + node.bounds[a + 3][i] * scale[a];
+            }
+            masks[i] = intersect_packet(box, packet, active);
+            if (masks[i] != 0)
+                hit_children |= 1 << i;
+        }
+        return hit_children;
+    }
+#endif
+}
@@ -0,0 +1,365 @@
+#include <algorithm>
+#include "bvh.h"
+#include "thread_pool.h"
+using namespace raytracer;
+
+/*
+ *  Split BVH builder (Stich et al. 2009, "Spatial Splits in Bounding Volume Hierarchies").
+ *  Besides the usual object splits, a node can be split by a plane that cuts through
+ *  its primitives: every primitive straddling the plane is referenced by both children,
+ *  each with its bounds clipped to its side. This removes most of the overlap between
+ *  the children of nodes over long, thin triangles, at the cost of duplicate references.
+ */
+
+// Subtrees over fewer references than this are built on the thread that split their parent
+static const size_t min_parallel_build_size = 4096;
+
+struct Reference
+{
+    int index;
+    Eigen::AlignedBox3f bounds; // the part of the primitive inside the node
+};
+
+struct Split
+{
+    float cost = infinity;
+    int axis = -1;
+    int bin = -1;
+    Eigen::AlignedBox3f left_bounds, right_bounds;
+};
+
+struct SBVHBuildState
+{
+    const PrimitiveClipper &clip;
+    const BVHBuildParams &params;
+    float inv_root_area;
+};
+
+static int bin_of(float x, float min, float extent, int num_bins)
+{
+    int b = (int)(num_bins * ((x - min) / extent));
+    return std::max(0, std::min(b, num_bins - 1));
+}
+
+// Evaluates the binned SAH for object splits along every axis, like partition_sah does for a single one
+static Split find_object_split(const std::vector<Reference> &refs, const Eigen::AlignedBox3f &bounds,
+                               const Eigen::AlignedBox3f &centroid_bounds, const BVHBuildParams &params)
+{
+    const int num_bins = params.num_bins;
+    float inv_area = 1.0f / surface_area(bounds);
+    Split best;
+    for (int axis = 0; axis < 3; axis++)
+    {
+        float min_c = centroid_bounds.min()[axis];
+        float extent = centroid_bounds.max()[axis] - min_c;
+        if (extent <= 0.0f)
+            continue;
+
+        std::vector<int> bin_count(num_bins, 0);
+        std::vector<Eigen::AlignedBox3f> bin_bounds(num_bins);
+        for (const auto &ref : refs)
+        {
+            int b = bin_of(ref.bounds.center()[axis], min_c, extent, num_bins);
+            bin_count[b]++;
+            bin_bounds[b].extend(ref.bounds);
+        }
+
+        std::vector<Eigen::AlignedBox3f> right_box(num_bins);
+        std::vector<int> right_count(num_bins, 0);
+        for (int b = num_bins - 1; b > 0; b--)
+        {
+            right_box[b] = bin_bounds[b];
+            right_count[b] = bin_count[b];
+            if (b < num_bins - 1)
+            {
+                right_box[b].extend(right_box[b + 1]);
+                right_count[b] += right_count[b + 1];
+            }
+        }
+
+        Eigen::AlignedBox3f left_box;
+        int count = 0;
+        for (int b = 0; b < num_bins - 1; b++)
+        {
+            left_box.extend(bin_bounds[b]);
+            count += bin_count[b];
+            if (count == 0 || right_count[b + 1] == 0)
+                continue;
+            float cost = params.traversal_cost + params.intersection_cost * inv_area *
+                                                     (count * surface_area(left_box) + right_count[b + 1] * surface_area(right_box[b + 1]));
+            if (cost < best.cost)
+            {
+                best.cost = cost;
+                best.axis = axis;
+                best.bin = b;
+                best.left_bounds = left_box;
+                best.right_bounds = right_box[b + 1];
+            }
+        }
+    }
+    return best;
+}
+
+// The slab of the node between two planes along axis
+static Eigen::AlignedBox3f slab(const Eigen::AlignedBox3f &bounds, int axis, float lo, float hi)
+{
+    Eigen::AlignedBox3f box = bounds;
+    box.min()[axis] = lo;
+    box.max()[axis] = hi;
+    return box;
+}
+
+// Evaluates the SAH for splitting planes placed uniformly across the node, binning the
+// clipped references: a reference enters the first bin it overlaps and exits the last one
+static Split find_spatial_split(const std::vector<Reference> &refs, const Eigen::AlignedBox3f &bounds, const SBVHBuildState &state)
+{
+    const BVHBuildParams &params = state.params;
+    const int num_bins = params.num_bins;
+    float inv_area = 1.0f / surface_area(bounds);
+    Split best;
+    for (int axis = 0; axis < 3; axis++)
+    {
+        float min_b = bounds.min()[axis];
+        float extent = bounds.max()[axis] - min_b;
+        if (extent <= 0.0f)
+            continue;
+        float bin_width = extent / num_bins;
+
+        std::vector<int> entry(num_bins, 0), exit(num_bins, 0);
+        std::vector<Eigen::AlignedBox3f> bin_bounds(num_bins);
+        for (const auto &ref : refs)
+        {
+            int first = bin_of(ref.bounds.min()[axis], min_b, extent, num_bins);
+            int last = bin_of(ref.bounds.max()[axis], min_b, extent, num_bins);
+            entry[first]++;
+            exit[last]++;
+            if (first == last)
+            {
+                bin_bounds[first].extend(ref.bounds);
+                continue;
+            }
+            for (int b = first; b <= last; b++)
+            {
+                Eigen::AlignedBox3f bin_box = slab(ref.bounds, axis, std::max(ref.bounds.min()[axis], min_b + b * bin_width),
+                                                   std::min(ref.bounds.max()[axis], min_b + (b + 1) * bin_width));
+                bin_bounds[b].extend(state.clip(ref.index, bin_box));
+            }
+        }
+
+        std::vector<Eigen::AlignedBox3f> right_box(num_bins);
+        std::vector<int> right_count(num_bins, 0);
+        for (int b = num_bins - 1; b > 0; b--)
+        {
+            right_box[b] = bin_bounds[b];
+            right_count[b] = exit[b];
+            if (b < num_bins - 1)
+            {
+                right_box[b].extend(right_box[b + 1]);
+                right_count[b] += right_count[b + 1];
+            }
+        }
+
+        Eigen::AlignedBox3f left_box;
+        int count = 0;
+        for (int b = 0; b < num_bins - 1; b++)
+        {
+            left_box.extend(bin_bounds[b]);
+            count += entry[b];
+            if (count == 0 || right_count[b + 1] == 0)
+                continue;
+            float cost = params.traversal_cost + params.intersection_cost * inv_area *
+                                                     (count * surface_area(left_box) + right_count[b + 1] * surface_area(right_box[b + 1]));
+            if (cost < best.cost)
+            {
+                best.cost = cost;
+                best.axis = axis;
+                best.bin = b;
+                best.left_bounds = left_box;
+                best.right_bounds = right_box[b + 1];
+            }
+        }
+    }
+    return best;
+}
+
+// Every reference straddling the plane takes one from duplicate_budget, the number of references the subtree may still add
+static void split_references(std::vector<Reference> &refs, int axis, float position, const SBVHBuildState &state, long &duplicate_budget,
+                             std::vector<Reference> &left, std::vector<Reference> &right)
+{
+    for (const auto &ref : refs)
+    {
+        if (ref.bounds.max()[axis] <= position)
+            left.push_back(ref);
+        else if (ref.bounds.min()[axis] >= position)
+            right.push_back(ref);
+        else if (duplicate_budget > 0)
+        {
+            duplicate_budget--;
+            Reference l = {ref.index, state.clip(ref.index, slab(ref.bounds, axis, ref.bounds.min()[axis], position))};
+            Reference r = {ref.index, state.clip(ref.index, slab(ref.bounds, axis, position, ref.bounds.max()[axis]))};
+            if (!l.bounds.isEmpty())
+                left.push_back(l);
+            if (!r.bounds.isEmpty())
+                right.push_back(r);
+            if (l.bounds.isEmpty() && r.bounds.isEmpty())
+                (ref.bounds.center()[axis] < position ? left : right).push_back(ref);
+        }
+        else
+        {
+            // Out of memory for duplicates, keep the reference whole on one side
+            (ref.bounds.center()[axis] < position ? left : right).push_back(ref);
+        }
+    }
+}
+
+// Appends the nodes and primitives of a subtree built separately, whose own indices start at 0
+static void append_subtree(std::vector<LinearBVHNode> &nodes, std::vector<int> &prims,
+                           const std::vector<LinearBVHNode> &subtree, const std::vector<int> &subtree_prims)
+{
+    int node_base = nodes.size();
+    int prim_base = prims.size();
+    for (LinearBVHNode node : subtree)
+    {
+        if (node.n_primitives == 0)
+            node.second_child_offset += node_base;
+        else
+            node.primitives_offset += prim_base;
+        nodes.push_back(node);
+    }
+    prims.insert(prims.end(), subtree_prims.begin(), subtree_prims.end());
+}
+
+/*
+ *  duplicate_budget is how many references the subtree may add by spatial splits, and is left at what
+ *  it didn't use. Children built one after the other pass what is left on; children built in parallel
+ *  get their share in proportion to their references before they start, so the tree never depends on
+ *  which thread happens to split first.
+ */
+static int recursive_build(std::vector<Reference> &refs, const SBVHBuildState &state, long &duplicate_budget, std::vector<LinearBVHNode> &nodes,
+                           std::vector<int> &prims, int depth)
+{
+    const BVHBuildParams &params = state.params;
+    int node_index = nodes.size();
+    nodes.emplace_back();
+
+    Eigen::AlignedBox3f bounds, centroid_bounds;
+    for (const auto &ref : refs)
+    {
+        bounds.extend(ref.bounds);
+        centroid_bounds.extend(ref.bounds.center());
+    }
+    nodes[node_index].bounds = bounds;
+
+    size_t n_refs = refs.size();
+    std::vector<Reference> left, right;
+    int axis = 0;
+    if (n_refs > 1 && depth < max_bvh_depth - 32)
+    {
+        Split object_split = find_object_split(refs, bounds, centroid_bounds, params);
+
+        // Only look for a spatial split where the children of the object split overlap noticeably
+        Split spatial_split;
+        if (object_split.axis >= 0 && duplicate_budget > 0)
+        {
+            Eigen::AlignedBox3f overlap = object_split.left_bounds.intersection(object_split.right_bounds);
+            if (surface_area(overlap) * state.inv_root_area > params.spatial_split_alpha)
+                spatial_split = find_spatial_split(refs, bounds, state);
+        }
+
+        float min_cost = std::min(object_split.cost, spatial_split.cost);
+        bool make_leaf = n_refs <= (size_t)params.max_leaf_size && params.intersection_cost * n_refs <= min_cost;
+        if (!make_leaf && spatial_split.cost < object_split.cost)
+        {
+            axis = spatial_split.axis;
+            float extent = bounds.max()[axis] - bounds.min()[axis];
+            float position = bounds.min()[axis] + extent * (spatial_split.bin + 1) / params.num_bins;
+            long budget = duplicate_budget;
+            split_references(refs, axis, position, state, budget, left, right);
+            if (left.empty() || right.empty())
+            {
+                left.clear();
+                right.clear();
+            }
+            else
+                duplicate_budget = budget;
+        }
+        if (!make_leaf && left.empty() && object_split.axis >= 0)
+        {
+            axis = object_split.axis;
+            float min_c = centroid_bounds.min()[axis];
+            float extent = centroid_bounds.max()[axis] - min_c;
+            for (const auto &ref : refs)
+                (bin_of(ref.bounds.center()[axis], min_c, extent, params.num_bins) <= object_split.bin ? left : right).push_back(ref);
+        }
+    }
+    if (left.empty() && n_refs > (size_t)params.max_leaf_size)
+    {
+        // No usable split or a pathologically deep tree, fall back to a median split
+        (centroid_bounds.max() - centroid_bounds.min()).maxCoeff(&axis);
+        size_t mid = n_refs / 2;
+        std::nth_element(refs.begin(), refs.begin() + mid, refs.end(),
+                         [axis](const Reference &a, const Reference &b)
+                         { return a.bounds.center()[axis] < b.bounds.center()[axis]; });
+        left.assign(refs.begin(), refs.begin() + mid);
+        right.assign(refs.begin() + mid, refs.end());
+    }
+
+    if (left.empty())
+    {
+        nodes[node_index].primitives_offset = prims.size();
+        nodes[node_index].n_primitives = n_refs;
+        nodes[node_index].axis = 0;
+        for (const auto &ref : refs)
+            prims.push_back(ref.index);
+        return node_index;
+    }
+
+    // The parent's references are no longer needed, free them before going deeper
+    std::vector<Reference>().swap(refs);
+
+    int second_child;
+    if (n_refs >= min_parallel_build_size)
+    {
+        ThreadPool *pool = ThreadPool::GetInstance();
+        std::vector<LinearBVHNode> left_nodes, right_nodes;
+        std::vector<int> left_prims, right_prims;
+        long left_budget = (long)(duplicate_budget * ((double)left.size() / (left.size() + right.size())));
+        long right_budget = duplicate_budget - left_budget;
+        auto left_done = pool->submit([&]
+                                      { recursive_build(left, state, left_budget, left_nodes, left_prims, depth + 1); });
+        recursive_build(right, state, right_budget, right_nodes, right_prims, depth + 1);
+        pool->wait(left_done);
+        duplicate_budget = left_budget + right_budget;
+
+        append_subtree(nodes, prims, left_nodes, left_prims);
+        second_child = nodes.size();
+        append_subtree(nodes, prims, right_nodes, right_prims);
+    }
+    else
+    {
+        recursive_build(left, state, duplicate_budget, nodes, prims, depth + 1);
+        second_child = recursive_build(right, state, duplicate_budget, nodes, prims, depth + 1);
+    }
+    nodes[node_index].second_child_offset = second_child;
+    nodes[node_index].n_primitives = 0;
+    nodes[node_index].axis = axis;
+    return node_index;
+}
+
+void raytracer::build_sbvh(const std::vector<Eigen::AlignedBox3f> &prim_bounds, const PrimitiveClipper &clip, const BVHBuildParams &params,
+                           std::vector<LinearBVHNode> &nodes, std::vector<int> &ordered_prims)
+{
+    std::vector<Reference> refs(prim_bounds.size());
+    Eigen::AlignedBox3f root_bounds;
+    for (size_t i = 0; i < prim_bounds.size(); i++)
+    {
+        refs[i].index = i;
+        refs[i].bounds = prim_bounds[i];
+        root_bounds.extend(prim_bounds[i]);
+    }
+
+    SBVHBuildState state = {clip, params, 1.0f / surface_area(root_bounds)};
+    long duplicate_budget = (long)(params.max_duplication * prim_bounds.size());
+
+    recursive_build(refs, state, duplicate_budget, nodes, ordered_prims, 0);
+}
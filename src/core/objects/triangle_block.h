@@ -0,0 +1,175 @@
+#pragma once
+#include "utilities.h"
+#include "ray.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace raytracer
+{
+    // Triangles per block. Matches the default BVH leaf size, so a leaf is usually a single block.
+    const int triangle_block_width = 4;
+
+    /*
+     *  The triangles of a BVH leaf, stored in SoA layout with everything the Möller–Trumbore
+     *  test needs precomputed: the first vertex and the two edges leaving it, in the space
+     *  the BVH is built in. prim holds the index of each triangle in the BVH's primitives;
+     *  unused lanes have -1 there and degenerate (zero) edges, which are never hit.
+     */
+    struct alignas(16) TriangleBlock
+    {
+        float v0[3][triangle_block_width];
+        float e1[3][triangle_block_width];
+        float e2[3][triangle_block_width];
+        int prim[triangle_block_width];
+
+        TriangleBlock()
+        {
+            for (int i = 0; i < triangle_block_width; i++)
+            {
+                for (int a = 0; a < 3; a++)
+                    v0[a][i] = e1[a][i] = e2[a][i] = 0.0f;
+                prim[i] = -1;
+            }
+        }
+
+        void set(int lane, int primitive, const Eigen::Vector3f vertices[3])
+        {
+            Eigen::Vector3f edge1 = vertices[1] - vertices[0];
+            Eigen::Vector3f edge2 = vertices[2] - vertices[0];
+            for (int a = 0; a < 3; a++)
+            {
+                v0[a][lane] = vertices[0][a];
+                e1[a][lane] = edge1[a];
+                e2[a][lane] = edge2[a];
+            }
+            prim[lane] = primitive;
+        }
+    };
+
+    /*
+     *  The closest hit found in a block. beta and gamma are the barycentric coordinates of the
+     *  second and third vertex, so the shading data can be interpolated once the search is over.
+     */
+    struct TriangleHit
+    {
+        int prim = -1;
+        float t = 0, beta = 0, gamma = 0;
+    };
+
+    /*
+     *  The ray broadcast to every lane, done once per ray instead of once per block.
+     */
+    struct TriangleRay
+    {
+#if defined(__SSE2__)
+        __m128 origin[3];
+        __m128 direction[3];
+#else
+        float origin[3];
+        float direction[3];
+#endif
+
+        TriangleRay(const Ray &r)
+        {
+            for (int a = 0; a < 3; a++)
+            {
+#if defined(__SSE2__)
+                origin[a] = _mm_set1_ps(r.origin[a]);
+                direction[a] = _mm_set1_ps(r.direction[a]);
+#else
+                origin[a] = r.origin[a];
+                direction[a] = r.direction[a];
+#endif
+            }
+        }
+    };
+
+    /*
+     *  Möller–Trumbore against all the triangles of a block at once. Returns the mask of the lanes
+     *  hit within [t_min, t_max] and writes their distances and barycentric coordinates. Degenerate
+     *  triangles produce NaNs, which fail every comparison.
+     */
+    inline int intersect_triangle_block(const TriangleBlock &block, const TriangleRay &ray, float t_min, float t_max,
+                                        float *t, float *beta, float *gamma)
+    {
+#if defined(__SSE2__)
+        const __m128 *o = ray.origin, *d = ray.direction;
+        __m128 e1[3], e2[3], tvec[3];
+        for (int a = 0; a < 3; a++)
+        {
+            e1[a] = _mm_load_ps(block.e1[a]);
+            e2[a] = _mm_load_ps(block.e2[a]);
+            tvec[a] = _mm_sub_ps(o[a], _mm_load_ps(block.v0[a]));
+        }
+
+        // pvec = d x e2, qvec = tvec x e1
+        __m128 px = _mm_sub_ps(_mm_mul_ps(d[1], e2[2]), _mm_mul_ps(d[2], e2[1]));
+        __m128 py = _mm_sub_ps(_mm_mul_ps(d[2], e2[0]), _mm_mul_ps(d[0], e2[2]));
+        __m128 pz = _mm_sub_ps(_mm_mul_ps(d[0], e2[1]), _mm_mul_ps(d[1], e2[0]));
+        __m128 qx = _mm_sub_ps(_mm_mul_ps(tvec[1], e1[2]), _mm_mul_ps(tvec[2], e1[1]));
+        __m128 qy = _mm_sub_ps(_mm_mul_ps(tvec[2], e1[0]), _mm_mul_ps(tvec[0], e1[2]));
+        __m128 qz = _mm_sub_ps(_mm_mul_ps(tvec[0], e1[1]), _mm_mul_ps(tvec[1], e1[0]));
+
+        __m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1[0], px), _mm_mul_ps(e1[1], py)), _mm_mul_ps(e1[2], pz));
+        __m128 inv_det = _mm_div_ps(_mm_set1_ps(1.0f), det);
+
+        __m128 u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(tvec[0], px), _mm_mul_ps(tvec[1], py)), _mm_mul_ps(tvec[2], pz)), inv_det);
+        __m128 v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(d[0], qx), _mm_mul_ps(d[1], qy)), _mm_mul_ps(d[2], qz)), inv_det);
+        __m128 dist = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2[0], qx), _mm_mul_ps(e2[1], qy)), _mm_mul_ps(e2[2], qz)), inv_det);
+
+        __m128 zero = _mm_setzero_ps();
+        __m128 inside = _mm_and_ps(_mm_cmpge_ps(u, zero), _mm_cmpge_ps(v, zero));
+        inside = _mm_and_ps(inside, _mm_cmple_ps(_mm_add_ps(u, v), _mm_set1_ps(1.0f)));
+        inside = _mm_and_ps(inside, _mm_cmpge_ps(dist, _mm_set1_ps(t_min)));
+        inside = _mm_and_ps(inside, _mm_cmple_ps(dist, _mm_set1_ps(t_max)));
+
+        _mm_storeu_ps(t, dist);
+        _mm_storeu_ps(beta, u);
+        _mm_storeu_ps(gamma, v);
+        return _mm_movemask_ps(inside);
+#else
+        int mask = 0;
+        for (int i = 0; i < triangle_block_width; i++)
+        {
+            Eigen::Vector3f d(ray.direction[0], ray.direction[1], ray.direction[2]);
+            Eigen::Vector3f e1(block.e1[0][i], block.e1[1][i], block.e1[2][i]);
+            Eigen::Vector3f e2(block.e2[0][i], block.e2[1][i], block.e2[2][i]);
+            Eigen::Vector3f tvec = Eigen::Vector3f(ray.origin[0], ray.origin[1], ray.origin[2]) -
+                                   Eigen::Vector3f(block.v0[0][i], block.v0[1][i], block.v0[2][i]);
+            Eigen::Vector3f pvec = d.cross(e2), qvec = tvec.cross(e1);
+            float inv_det = 1.0f / e1.dot(pvec);
+            beta[i] = tvec.dot(pvec) * inv_det;
+            gamma[i] = d.dot(qvec) * inv_det;
+            t[i] = e2.dot(qvec) * inv_det;
+            if (beta[i] >= 0.0f && gamma[i] >= 0.0f && beta[i] + gamma[i] <= 1.0f && t[i] >= t_min && t[i] <= t_max)
+                mask |= 1 << i;
+        }
+        return mask;
+#endif
+    }
+
+    // Keeps the closest of the block's hits in closest, returns whether it got any closer
+    inline bool closest_triangle_block_hit(const TriangleBlock &block, const TriangleRay &ray, float t_min, float t_max, TriangleHit &closest)
+    {
+        float t[triangle_block_width], beta[triangle_block_width], gamma[triangle_block_width];
+        int mask = intersect_triangle_block(block, ray, t_min, t_max, t, beta, gamma);
+        bool found = false;
+        while (mask != 0)
+        {
+            int i = __builtin_ctz(mask);
+            mask &= mask - 1;
+            if (t[i] <= t_max)
+            {
+                t_max = t[i];
+                closest.prim = block.prim[i];
+                closest.t = t[i];
+                closest.beta = beta[i];
+                closest.gamma = gamma[i];
+                found = true;
+            }
+        }
+        return found;
+    }
+}
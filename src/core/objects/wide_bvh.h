@@ -0,0 +1,197 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include "utilities.h"
+
+/*
+ *  The branching factor of the traversal BVH is chosen at compile time from the
+ *  instruction set we are building for: 8 children with AVX, 4 with SSE. Without
+ *  either, the binary BVH is traversed directly.
+ */
+#if defined(__AVX__)
+#include <immintrin.h>
+#define RT_BVH_WIDTH 8
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define RT_BVH_WIDTH 4
+#else
+#define RT_BVH_WIDTH 2
+#endif
+
+namespace raytracer
+{
+    const int bvh_width = RT_BVH_WIDTH;
+
+    /*
+     *  A node of the collapsed BVH, storing the boxes of up to bvh_width children
+     *  in SoA layout so all of them can be tested against a ray at once.
+     *  Rows 0-2 of bounds hold the lower x, y, z planes and rows 3-5 the upper ones.
+     *  A child with count > 0 is a leaf covering the primitives [child, child + count),
+     *  otherwise child is the index of another wide node. Unused slots have an inverted
+     *  (empty) box, so they are never hit.
+     */
+    struct WideBVHNode
+    {
+        float bounds[6][bvh_width];
+        int child[bvh_width];
+        int count[bvh_width];
+    };
+
+    /*
+     *  WideBVHNode with the child boxes quantized to 8 bits per plane against the box of the node
+     *  itself: along axis a, plane value q stands for origin[a] + q * 2^exponent[a]. The planes are
+     *  rounded outwards, so a child box can only grow. Takes 112 bytes instead of 256 with 8 children.
+     */
+    struct CompactWideBVHNode
+    {
+        float origin[3];
+        int8_t exponent[3];
+        uint8_t valid; // mask of the child slots in use
+        uint8_t bounds[6][bvh_width];
+        int child[bvh_width];
+        uint16_t count[bvh_width];
+    };
+
+    // 2^e as a float, for the exponents of CompactWideBVHNode (-126 <= e <= 127)
+    inline float exp2_int(int e)
+    {
+        uint32_t bits = (uint32_t)(e + 127) << 23;
+        float f;
+        memcpy(&f, &bits, sizeof(f));
+        return f;
+    }
+
+#if RT_BVH_WIDTH > 2
+    /*
+     *  The ray data needed by the slab test, broadcast to every SIMD lane once per ray.
+     *  near[a] and far[a] select the row of WideBVHNode::bounds holding the entry and exit
+     *  plane along axis a, which depends only on the sign of the direction.
+     */
+    struct WideRay
+    {
+#if RT_BVH_WIDTH == 8
+        __m256 origin[3];
+        __m256 inv_dir[3];
+#else
+        __m128 origin[3];
+        __m128 inv_dir[3];
+#endif
+        int near[3], far[3];
+
+        WideRay(const Eigen::Vector3f &o, const Eigen::Vector3f &inv_d)
+        {
+            for (int a = 0; a < 3; a++)
+            {
+#if RT_BVH_WIDTH == 8
+                origin[a] = _mm256_set1_ps(o[a]);
+                inv_dir[a] = _mm256_set1_ps(inv_d[a]);
+#else
+                origin[a] = _mm_set1_ps(o[a]);
+                inv_dir[a] = _mm_set1_ps(inv_d[a]);
+#endif
+                near[a] = inv_d[a] < 0 ? a + 3 : a;
+                far[a] = inv_d[a] < 0 ? a : a + 3;
+            }
+        }
+    };
+
+    /*
+     *  Tests the ray against all the child boxes of a node in a single pass.
+     *  Returns a bit mask of the children that are hit and writes the distance
+     *  at which the ray enters each box to t_entry.
+     *  max_ps and min_ps return their second operand if either is NaN, which happens for a ray
+     *  parallel to an axis that starts on a slab plane (0 * inf); the running interval goes
+     *  second so such a plane is ignored, as in hit_aabb().
+     */
+    inline int intersect_children(const WideBVHNode &node, const WideRay &ray, float t_min, float t_max, float *t_entry)
+    {
+#if RT_BVH_WIDTH == 8
+        __m256 t_near = _mm256_set1_ps(t_min);
+        __m256 t_far = _mm256_set1_ps(t_max);
+        for (int a = 0; a < 3; a++)
+        {
+            __m256 t0 = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(node.bounds[ray.near[a]]), ray.origin[a]), ray.inv_dir[a]);
+            __m256 t1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(node.bounds[ray.far[a]]), ray.origin[a]), ray.inv_dir[a]);
+            t_near = _mm256_max_ps(t0, t_near);
+            t_far = _mm256_min_ps(t1, t_far);
+        }
+        _mm256_storeu_ps(t_entry, t_near);
+        return _mm256_movemask_ps(_mm256_cmp_ps(t_near, t_far, _CMP_LE_OQ));
+#else
+        __m128 t_near = _mm_set1_ps(t_min);
+        __m128 t_far = _mm_set1_ps(t_max);
+        for (int a = 0; a < 3; a++)
+        {
+            __m128 t0 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.bounds[ray.near[a]]), ray.origin[a]), ray.inv_dir[a]);
+            __m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.bounds[ray.far[a]]), ray.origin[a]), ray.inv_dir[a]);
+            t_near = _mm_max_ps(t0, t_near);
+            t_far = _mm_min_ps(t1, t_far);
+        }
+        _mm_storeu_ps(t_entry, t_near);
+        return _mm_movemask_ps(_mm_cmple_ps(t_near, t_far));
+#endif
+    }
+
+    /*
+     *  The same test against a compact node, decoding the planes on the fly. The decoded planes go
+     *  through the same slab test as above, so rays parallel to an axis are handled the same way.
+     */
+    inline int intersect_children(const CompactWideBVHNode &node, const WideRay &ray, float t_min, float t_max, float *t_entry)
+    {
+#if RT_BVH_WIDTH == 8
+        __m256 t_near = _mm256_set1_ps(t_min);
+        __m256 t_far = _mm256_set1_ps(t_max);
+        for (int a = 0; a < 3; a++)
+        {
+            __m256 origin = _mm256_set1_ps(node.origin[a]);
+            __m256 scale = _mm256_set1_ps(exp2_int(node.exponent[a]));
+            __m256 q_near, q_far;
+#if defined(__AVX2__)
+            q_near = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)node.bounds[ray.near[a]])));
+            q_far = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)node.bounds[ray.far[a]])));
+#else
+            float near_planes[8], far_planes[8];
+            for (int i = 0; i < 8; i++)
+            {
+                near_planes[i] = node.bounds[ray.near[a]][i];
+                far_planes[i] = node.bounds[ray.far[a]][i];
+            }
+            q_near = _mm256_loadu_ps(near_planes);
+            q_far = _mm256_loadu_ps(far_planes);
+#endif
+            __m256 near_plane = _mm256_add_ps(origin, _mm256_mul_ps(q_near, scale));
+            __m256 far_plane = _mm256_add_ps(origin, _mm256_mul_ps(q_far, scale));
+            __m256 t0 = _mm256_mul_ps(_mm256_sub_ps(near_plane, ray.origin[a]), ray.inv_dir[a]);
+            __m256 t1 = _mm256_mul_ps(_mm256_sub_ps(far_plane, ray.origin[a]), ray.inv_dir[a]);
+            t_near = _mm256_max_ps(t0, t_near);
+            t_far = _mm256_min_ps(t1, t_far);
+        }
+        _mm256_storeu_ps(t_entry, t_near);
+        return _mm256_movemask_ps(_mm256_cmp_ps(t_near, t_far, _CMP_LE_OQ)) & node.valid;
+#else
+        __m128 t_near = _mm_set1_ps(t_min);
+        __m128 t_far = _mm_set1_ps(t_max);
+        __m128i zero = _mm_setzero_si128();
+        for (int a = 0; a < 3; a++)
+        {
+            __m128 origin = _mm_set1_ps(node.origin[a]);
+            __m128 scale = _mm_set1_ps(exp2_int(node.exponent[a]));
+            int near_bytes, far_bytes;
+            memcpy(&near_bytes, node.bounds[ray.near[a]], sizeof(int));
+            memcpy(&far_bytes, node.bounds[ray.far[a]], sizeof(int));
+            __m128i q_near = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(near_bytes), zero), zero);
+            __m128i q_far = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(far_bytes), zero), zero);
+            __m128 near_plane = _mm_add_ps(origin, _mm_mul_ps(_mm_cvtepi32_ps(q_near), scale));
+            __m128 far_plane = _mm_add_ps(origin, _mm_mul_ps(_mm_cvtepi32_ps(q_far), scale));
+            __m128 t0 = _mm_mul_ps(_mm_sub_ps(near_plane, ray.origin[a]), ray.inv_dir[a]);
+            __m128 t1 = _mm_mul_ps(_mm_sub_ps(far_plane, ray.origin[a]), ray.inv_dir[a]);
+            t_near = _mm_max_ps(t0, t_near);
+            t_far = _mm_min_ps(t1, t_far);
+        }
+        _mm_storeu_ps(t_entry, t_near);
+        return _mm_movemask_ps(_mm_cmple_ps(t_near, t_far)) & node.valid;
+#endif
+    }
+#endif
+}
\ No newline at end of file
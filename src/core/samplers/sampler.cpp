@@ -5,24 +5,18 @@ using namespace raytracer;
 
 Sampler::Sampler() : num_samples(1), num_sets(83)
 {
-    count.store(0, std::memory_order::memory_order_relaxed);
-    jump.store(0, std::memory_order::memory_order_relaxed);
     samples.reserve(num_samples * num_sets);
     setup_shuffled_indices();
 }
 
-Sampler::Sampler(const int ns) : num_samples(ns), num_sets(83), count(0)
+Sampler::Sampler(const int ns) : num_samples(ns), num_sets(83)
 {
-    count.store(0, std::memory_order::memory_order_relaxed);
-    jump.store(0, std::memory_order::memory_order_relaxed);
     samples.reserve(num_samples * num_sets);
     setup_shuffled_indices();
 }
 
 Sampler::Sampler(const int ns, const int n_sets) : num_samples(ns), num_sets(n_sets)
 {
-    count.store(0, std::memory_order::memory_order_relaxed);
-    jump.store(0, std::memory_order::memory_order_relaxed);
     samples.reserve(num_samples * num_sets);
     setup_shuffled_indices();
 }
@@ -38,8 +32,6 @@ Sampler::Sampler(const Sampler &s)
       hemisphere_samples(s.hemisphere_samples),
       sphere_samples(s.sphere_samples)
 {
-    count.store(0, std::memory_order::memory_order_relaxed);
-    jump.store(0, std::memory_order::memory_order_relaxed);
 }
 
 Sampler::Sampler(Sampler &&s) noexcept
@@ -51,8 +43,6 @@ Sampler::Sampler(Sampler &&s) noexcept
       hemisphere_samples(std::move(s.hemisphere_samples)),
       sphere_samples(std::move(s.sphere_samples))
 {
-    count.store(0, std::memory_order_relaxed);
-    jump.store(0, std::memory_order_relaxed);
 }
 
 Sampler &Sampler::operator=(const Sampler &s)
@@ -64,9 +54,6 @@ Sampler &Sampler::operator=(const Sampler &s)
     disk_samples = s.disk_samples;
     hemisphere_samples = s.hemisphere_samples;
     sphere_samples = s.sphere_samples;
-    count.store(s.count.load(std::memory_order_relaxed), std::memory_order_relaxed);
-    jump.store(s.jump.load(std::memory_order_relaxed), std::memory_order_relaxed);
-
     return *this;
 }
 
@@ -79,9 +66,6 @@ Sampler &Sampler::operator=(Sampler &&s) noexcept
     disk_samples = std::move(s.disk_samples);
     hemisphere_samples = std::move(s.hemisphere_samples);
     sphere_samples = std::move(s.sphere_samples);
-    count.store(s.count.load(std::memory_order_relaxed), std::memory_order_relaxed);
-    jump.store(s.jump.load(std::memory_order_relaxed), std::memory_order_relaxed);
-
     return *this;
 }
 
@@ -155,7 +139,7 @@ void Sampler::map_samples_to_unit_disk()
     float r, phi;       // polar coordinates
     Eigen::Vector2f sp; // sample point on unit disk
 
-    disk_samples.reserve(size);
+    disk_samples.resize(size);
 
     for (int j = 0; j < size; j++)
     {
@@ -249,57 +233,40 @@ void Sampler::map_samples_to_sphere()
     }
 }
 
-// the final version in Listing 5.13
+// Stateless replacement of the count and jump of Listing 5.13: the set is picked by hashing the pixel,
+// the dimension and which run of num_samples samples this is, the point within it by the sample index
 
-Eigen::Vector2f Sampler::sample_unit_square()
+int Sampler::next_index() const
 {
-    unsigned long long c = count.load(std::memory_order_relaxed);
-    if (c % num_samples == 0)
-    {                                                   // start of a new pixel
-        jump.store((random_int() % num_sets) * num_samples, std::memory_order_relaxed); // random index jump initialised to zero in constructor
-    }
-    int index = jump + shuffled_indices[jump + c % num_samples];
-    count.fetch_add(1, std::memory_order_relaxed);
-    return samples[index];
+    SamplingContext &context = SamplingContext::current();
+    int dimension = context.next_dimension();
+    uint64_t pixel = ((uint64_t)(uint32_t)context.pixel_y << 32) | (uint32_t)context.pixel_x;
+    uint64_t pattern = mix_bits(mix_bits(pixel) ^ (((uint64_t)dimension << 32) | (uint32_t)(context.sample_index / num_samples)));
+    int jump = (pattern % num_sets) * num_samples;
+    return jump + shuffled_indices[jump + context.sample_index % num_samples];
 }
 
-Eigen::Vector2f Sampler::sample_unit_disk()
+float Sampler::sample_1d() const
 {
-    unsigned long long c = count.load(std::memory_order_relaxed);
-    if (c % num_samples == 0)
-    { // start of a new pixel
-        jump.store((random_int() % num_sets) * num_samples, std::memory_order_relaxed);
-    }
-    Eigen::Vector2f v = disk_samples[jump + shuffled_indices[jump + c % num_samples]];
-    count.fetch_add(1, std::memory_order_relaxed);
-    return v;
+    return samples[next_index()].x();
 }
 
-Eigen::Vector3f Sampler::sample_hemisphere()
+Eigen::Vector2f Sampler::sample_unit_square() const
 {
-    unsigned long long c = count.load(std::memory_order_relaxed);
-    if (c % num_samples == 0)
-    { // start of a new pixel
-        jump.store((random_int() % num_sets) * num_samples, std::memory_order_relaxed);
-    }
-    Eigen::Vector3f v = hemisphere_samples[jump + shuffled_indices[jump + c % num_samples]];
-    count.fetch_add(1, std::memory_order_relaxed);
-    return v;
+    return samples[next_index()];
 }
 
-Eigen::Vector3f Sampler::sample_sphere()
+Eigen::Vector2f Sampler::sample_unit_disk() const
 {
-    unsigned long long c = count.load(std::memory_order_relaxed);
-    if (c % num_samples == 0)
-    { // start of a new pixel
-        jump.store((random_int() % num_sets) * num_samples, std::memory_order_relaxed);
-    }
-    Eigen::Vector3f v = sphere_samples[jump + shuffled_indices[jump + c % num_samples]];
-    count.fetch_add(1, std::memory_order_relaxed);
-    return v;
+    return disk_samples[next_index()];
 }
 
-// This is a specialised function called in LatticeNoise::init_vector_table
-// It doesn't shuffle the indices
+Eigen::Vector3f Sampler::sample_hemisphere() const
+{
+    return hemisphere_samples[next_index()];
+}
 
-Eigen::Vector2f Sampler::sample_one_set() { return samples[count++ % num_samples]; }
+Eigen::Vector3f Sampler::sample_sphere() const
+{
+    return sphere_samples[next_index()];
+}
@@ -1,7 +1,5 @@
 #pragma once
 
-#include <atomic>
-
 #include "utilities.h"
 
 namespace raytracer
@@ -40,29 +38,29 @@ namespace raytracer
 
         void setup_shuffled_indices();
 
-        void map_samples_to_unit_disk();
+        virtual void map_samples_to_unit_disk();
 
-        void map_samples_to_hemisphere(const float p);
+        virtual void map_samples_to_hemisphere(const float p);
 
-        void map_samples_to_sphere();
+        virtual void map_samples_to_sphere();
 
-        // the following functions are not const because they change count and jump
+        // The following take the next dimension of the pixel sample in the calling thread's SamplingContext.
+        // All samples of a pixel in one dimension come from the same set, so they stay stratified.
 
-        Eigen::Vector2f // get next sample on unit square
-        sample_unit_square();
+        virtual float // get next sample in [0, 1)
+        sample_1d() const;
 
-        Eigen::Vector2f // get next sample on unit disk
-        sample_unit_disk();
+        virtual Eigen::Vector2f // get next sample on unit square
+        sample_unit_square() const;
 
-        Eigen::Vector3f // get next sample on unit hemisphere
-        sample_hemisphere();
+        virtual Eigen::Vector2f // get next sample on unit disk
+        sample_unit_disk() const;
 
-        Eigen::Vector3f // get next sample on unit sphere
-        sample_sphere();
+        virtual Eigen::Vector3f // get next sample on unit hemisphere
+        sample_hemisphere() const;
 
-        Eigen::Vector2f           // only used to set up a vector noise table
-        sample_one_set(); // this is not discussed in the book, but see the
-                          // file LatticeNoise.cpp in Chapter 31
+        virtual Eigen::Vector3f // get next sample on unit sphere
+        sample_sphere() const;
 
     protected:
         int num_samples;                         // the number of sample points in a set
@@ -72,10 +70,9 @@ namespace raytracer
         std::vector<Eigen::Vector2f> disk_samples;       // sample points on a unit disk
         std::vector<Eigen::Vector3f> hemisphere_samples; // sample points on a unit hemisphere
         std::vector<Eigen::Vector3f> sphere_samples;     // sample points on a unit sphere
-        // unsigned long count;                     // the current number of sample points used
-        // int jump;                                // random index jump
-        std::atomic<unsigned long> count;
-        std::atomic<int> jump;
+
+        // Index of the point to use for the next dimension of the current pixel sample
+        int next_index() const;
     };
 
 }
\ No newline at end of file
@@ -0,0 +1,38 @@
+#pragma once
+#include "pcg32.h"
+
+namespace raytracer
+{
+    /*
+     *  The random state of one thread. random_float() and random_int() draw from the context of
+     *  the calling thread, so materials, BRDFs and lights sample without any shared state.
+     *  The render threads restart it for every pixel sample, which makes every pixel sample use
+     *  the same numbers whichever thread renders it, so renders are reproducible.
+     *  Samplers don't keep any state either: they pick their points from the pixel, the sample index
+     *  and the dimension, which counts the samplers' draws since the pixel sample started.
+     */
+    class SamplingContext
+    {
+    public:
+        PCG32 rng;
+        int pixel_x = 0, pixel_y = 0, sample_index = 0;
+        int dimension = 0;
+
+        void start_pixel_sample(int x, int y, int sample)
+        {
+            pixel_x = x;
+            pixel_y = y;
+            sample_index = sample;
+            dimension = 0;
+            rng.seed(mix_bits(((uint64_t)(uint32_t)y << 32) | (uint32_t)x), mix_bits(sample));
+        }
+
+        int next_dimension() { return dimension++; }
+
+        static SamplingContext &current()
+        {
+            thread_local SamplingContext context;
+            return context;
+        }
+    };
+}
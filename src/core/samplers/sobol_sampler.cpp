@@ -0,0 +1,63 @@
+#include "sobol_sampler.h"
+#include "sobol.h"
+using namespace raytracer;
+
+SobolSampler::SobolSampler() : Sampler(1, 1) {}
+
+SobolSampler *SobolSampler::clone() const { return new SobolSampler(*this); }
+
+Eigen::Vector2f SobolSampler::sample_unit_square() const
+{
+    SamplingContext &context = SamplingContext::current();
+    uint64_t pixel = ((uint64_t)(uint32_t)context.pixel_y << 32) | (uint32_t)context.pixel_x;
+    uint32_t seed = (uint32_t)mix_bits(mix_bits(pixel) ^ (uint64_t)context.next_dimension());
+
+    Eigen::Vector2f p;
+    sobol_2d(context.sample_index, seed, p.x(), p.y());
+    return p;
+}
+
+float SobolSampler::sample_1d() const
+{
+    return sample_unit_square().x();
+}
+
+// Shirley and Chiu's concentric map, as in Sampler::map_samples_to_unit_disk()
+Eigen::Vector2f SobolSampler::sample_unit_disk() const
+{
+    Eigen::Vector2f sp = 2.0f * sample_unit_square() - Eigen::Vector2f(1.0f, 1.0f);
+    if (sp.x() == 0.0f && sp.y() == 0.0f)
+        return sp;
+
+    float r, phi;
+    if (fabs(sp.x()) > fabs(sp.y()))
+    {
+        r = sp.x();
+        phi = (pi / 4.0f) * (sp.y() / sp.x());
+    }
+    else
+    {
+        r = sp.y();
+        phi = pi / 2.0f - (pi / 4.0f) * (sp.x() / sp.y());
+    }
+    return Eigen::Vector2f(r * cos(phi), r * sin(phi));
+}
+
+Eigen::Vector3f SobolSampler::sample_hemisphere() const
+{
+    Eigen::Vector2f s = sample_unit_square();
+    float cos_phi = cos(2.0 * pi * s.x());
+    float sin_phi = sin(2.0 * pi * s.x());
+    float cos_theta = pow((1.0f - s.y()), 1.0f / (hemisphere_exp + 1.0f));
+    float sin_theta = sqrt(1.0f - cos_theta * cos_theta);
+    return Eigen::Vector3f(sin_theta * cos_phi, sin_theta * sin_phi, cos_theta);
+}
+
+Eigen::Vector3f SobolSampler::sample_sphere() const
+{
+    Eigen::Vector2f s = sample_unit_square();
+    float z = 1.0f - 2.0f * s.x();
+    float r = sqrt(std::max(0.0f, 1.0f - z * z));
+    float phi = 2 * pi * s.y();
+    return Eigen::Vector3f(r * cos(phi), r * sin(phi), z);
+}
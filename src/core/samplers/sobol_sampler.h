@@ -0,0 +1,51 @@
+#pragma once
+#include "sampler.h"
+
+namespace raytracer
+{
+    /*
+     *  Owen scrambled Sobol points computed on the fly instead of read from precomputed sets
+     *  (see sobol.h). Every dimension of a pixel sample gets its own scramble, so the points stay
+     *  well distributed in each dimension and unrelated between dimensions and pixels, for any
+     *  number of samples per pixel.
+     */
+    class SobolSampler : public Sampler
+    {
+    public:
+        SobolSampler();
+
+        ~SobolSampler() = default;
+
+        SobolSampler(const SobolSampler &r) = default;
+
+        SobolSampler(SobolSampler &&r) = default;
+
+        SobolSampler &operator=(const SobolSampler &rhs) = default;
+
+        SobolSampler &operator=(SobolSampler &&rhs) = default;
+
+        virtual SobolSampler *clone() const override;
+
+        // There are no stored points to map, the mappings are applied to every point
+        virtual void map_samples_to_unit_disk() override {}
+
+        virtual void map_samples_to_hemisphere(const float exp) override { hemisphere_exp = exp; }
+
+        virtual void map_samples_to_sphere() override {}
+
+        virtual float sample_1d() const override;
+
+        virtual Eigen::Vector2f sample_unit_square() const override;
+
+        virtual Eigen::Vector2f sample_unit_disk() const override;
+
+        virtual Eigen::Vector3f sample_hemisphere() const override;
+
+        virtual Eigen::Vector3f sample_sphere() const override;
+
+    private:
+        float hemisphere_exp = 1.0f;
+
+        virtual void generate_samples() override {}
+    };
+}
@@ -8,7 +8,15 @@ Color DirectLightingTracer::trace_ray(const raytracer::Ray &r, World &world, int
     if (depth <= 0)
         return Color::black;
     HitInfo rec(world);
-    if (world.hit_objects(r, Interval(0.001, infinity), rec))
+    bool hit = world.hit_objects(r, Interval(0.001, infinity), rec);
+    return trace_hit(r, rec, hit, world, depth);
+}
+
+Color DirectLightingTracer::trace_hit(const raytracer::Ray &r, HitInfo &rec, bool hit, World &world, int depth)
+{
+    if (depth <= 0)
+        return Color::black;
+    if (hit)
     {
         return rec.material->shade(r, rec);
     }
@@ -25,7 +25,16 @@ Color PathTracer::trace_ray(const Ray &r, World &world, int depth)
         return Color(0, 0, 0);
 
     HitInfo rec(world);
-    if (world.hit_objects(r, Interval(0.0001, infinity), rec))
+    bool hit = world.hit_objects(r, Interval(0.0001, infinity), rec);
+    return trace_hit(r, rec, hit, world, depth);
+}
+
+Color PathTracer::trace_hit(const Ray &r, HitInfo &rec, bool hit, World &world, int depth)
+{
+    if (depth <= 0)
+        return Color(0, 0, 0);
+
+    if (hit)
     {
         Color total(0, 0, 0);
 
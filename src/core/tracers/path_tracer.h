@@ -7,5 +7,6 @@ namespace raytracer
     public:
         PathTracer() {}
         Color trace_ray(const raytracer::Ray &r, World &world, int depth) override;
+        Color trace_hit(const raytracer::Ray &r, HitInfo &rec, bool hit, World &world, int depth) override;
     };
 }
\ No newline at end of file
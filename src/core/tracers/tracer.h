@@ -10,5 +10,8 @@ namespace raytracer
     {
     public:
         virtual Color trace_ray(const raytracer::Ray &r, World &world, int depth) = 0;
+
+        // Same as trace_ray, for a ray whose closest hit was already found (e.g. as part of a packet)
+        virtual Color trace_hit(const raytracer::Ray &r, HitInfo &rec, bool hit, World &world, int depth) = 0;
     };
 }
\ No newline at end of file
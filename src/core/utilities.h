@@ -7,6 +7,7 @@
 #include <Eigen/Dense>
 
 #include "color.h"
+#include "sampling_context.h"
 
 const float infinity = std::numeric_limits<float>::infinity();
 const float pi = 3.1415926535897932385;
@@ -40,20 +41,16 @@ inline int clip(int x, int min, int max)
     return x;
 }
 
+// Uniform in [0, 1), from the sampling context of the calling thread
 inline float random_float()
 {
-    static std::random_device rd;
-    static std::mt19937 gen(rd());
-    static std::uniform_real_distribution<float> distribution(0.0, 1.0);
-    return distribution(gen);
+    return raytracer::SamplingContext::current().rng.next_float();
 }
 
+// Uniform in [0, 2^31 - 1]
 inline int random_int()
 {
-    static std::random_device rd;
-    static std::mt19937 gen(rd());
-    static std::uniform_int_distribution<int> distribution(0, std::numeric_limits<int>::max());
-    return distribution(gen);
+    return raytracer::SamplingContext::current().rng.next_uint() >> 1;
 }
 
 inline float random_float(float min, float max)
@@ -40,21 +40,58 @@ void raytracer::World::set_bg_color(Color c)
 
 bool raytracer::World::hit_objects(const raytracer::Ray &r, Interval t_range, HitInfo &rec)
 {
-    float t_min = t_range.min;
-    float t_max = t_range.max;
-    HitInfo temp_rec(*this);
-    temp_rec.depth = rec.depth;
+    // Only the distance of the hits is needed until the closest one is known
+    PrimitiveHit closest;
     bool hit_anything = false;
-    auto closest_so_far = t_max;
+    auto closest_so_far = t_range.max;
 
     for (const auto &object : objects)
     {
-        if (object->hit(r, Interval(t_min, closest_so_far), temp_rec))
+        if (object->find_hit(r, Interval(t_range.min, closest_so_far), closest))
         {
             hit_anything = true;
-            closest_so_far = temp_rec.t;
-            rec = temp_rec;
+            closest_so_far = closest.t;
         }
     }
+
+    if (hit_anything)
+        GeometricObject::fill_hit_info(r, closest, rec);
     return hit_anything;
-}
\ No newline at end of file
+}
+
+bool raytracer::World::shadow_hit_objects(const raytracer::Ray &r, Interval t_range) const
+{
+    for (const auto &object : objects)
+    {
+        if (object->shadow_hit(r, t_range))
+            return true;
+    }
+    return false;
+}
+
+int raytracer::World::hit_objects_packet(RayPacket &packet, HitInfo *recs)
+{
+    PrimitiveHit hits[RayPacket::max_size];
+    int hit_mask = 0;
+    for (const auto &object : objects)
+        hit_mask |= object->find_hit_packet(packet, hits, packet.all_lanes());
+
+    for (int lanes = hit_mask; lanes != 0; lanes &= lanes - 1)
+    {
+        int i = __builtin_ctz(lanes);
+        GeometricObject::fill_hit_info(packet.rays[i], hits[i], recs[i]);
+    }
+    return hit_mask;
+}
+
+int raytracer::World::shadow_hit_objects_packet(const RayPacket &packet) const
+{
+    int active = packet.all_lanes();
+    for (const auto &object : objects)
+    {
+        active &= ~object->shadow_hit_packet(packet, active);
+        if (active == 0)
+            break;
+    }
+    return packet.all_lanes() & ~active;
+}
@@ -45,5 +45,14 @@ namespace raytracer
         void set_bg_color(Color c);
 
         bool hit_objects(const raytracer::Ray &r, Interval t_range, HitInfo &rec);
+
+        // Whether anything blocks the ray within t_range, for visibility tests
+        bool shadow_hit_objects(const raytracer::Ray &r, Interval t_range) const;
+
+        // hit_objects for all the rays of a packet, returns the mask of the lanes that hit something
+        int hit_objects_packet(RayPacket &packet, HitInfo *recs);
+
+        // shadow_hit_objects for all the rays of a packet, returns the mask of the blocked lanes
+        int shadow_hit_objects_packet(const RayPacket &packet) const;
     };
 }
\ No newline at end of file
@@ -123,6 +123,7 @@ GUI::GUI()
     }
 
 extern std::atomic<bool> exit_requested;
+extern std::atomic<bool> stop_requested;
 GUI::~GUI()
 {
     // Cleanup
@@ -223,6 +224,13 @@ void GUI::update()
         if (instance->display_render)
         {
             ImGui::Text("Render progress");
+            if (!instance->finished)
+            {
+                // Stops the render after the samples in flight, the image so far is still saved
+                if (ImGui::Button("Stop"))
+                    stop_requested.store(true, std::memory_order_relaxed);
+                ImGui::SameLine();
+            }
             ImGui::ProgressBar(instance->get_progress(), ImVec2(-FLT_MIN, 0.0f));
 
             if (!instance->finished)
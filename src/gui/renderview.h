@@ -1,5 +1,7 @@
 #pragma once
 #include <mutex>
+#include <atomic>
+#include <cstdint>
 #include <iostream>
 #include <string.h>
 #include <GL/glew.h>
@@ -24,7 +26,8 @@ public:
                        // out of our framebuffer
 
     raytracer::BufferedImage *image;
-    unsigned int pixel_count = 0; // used to track progress
+    std::atomic<uint64_t> pixel_count{0}; // used to track progress, updated by all the render threads
+    unsigned int nr_passes = 1;   // every pass over the image updates all of its pixels once
 
     bool init = false;
     bool display_render = false;
@@ -46,12 +49,12 @@ public:
     void set_pixel_color(unsigned int x, unsigned int y, raytracer::Color color)
     {
         (*image).set(x, y, color);
-        pixel_count++;
+        pixel_count.fetch_add(1, std::memory_order_relaxed);
     }
 
     float get_progress()
     {
-        return (pixel_count * 1.0) / (image->get_height() * image->get_width());
+        return pixel_count.load(std::memory_order_relaxed) / ((double)image->get_height() * image->get_width() * nr_passes);
     }
 
     void create_framebuffer()
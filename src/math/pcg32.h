@@ -0,0 +1,65 @@
+#pragma once
+#include <cstdint>
+#include <algorithm>
+
+namespace raytracer
+{
+    // A 32 bit fixed point number in [0, 1) as a float, kept below 1 where rounding would reach it
+    inline float fixed_point_to_float(uint32_t x)
+    {
+        // 2^-32, and the largest float below 1
+        return std::min(x * 2.3283064365386963e-10f, 0.99999994f);
+    }
+
+    /*
+     *  The PCG32 generator of O'Neill, "PCG: A Family of Simple Fast Space-Efficient Statistically Good
+     *  Algorithms for Random Number Generation": 16 bytes of state and a handful of instructions per number.
+     *  Every odd increment selects a different stream, so generators seeded with different sequence
+     *  indices don't overlap.
+     */
+    class PCG32
+    {
+    public:
+        PCG32() { seed(0x853c49e6748fea9bull, 0xda3e39cb94b95bdbull); }
+
+        PCG32(uint64_t sequence_index, uint64_t offset) { seed(sequence_index, offset); }
+
+        void seed(uint64_t sequence_index, uint64_t offset)
+        {
+            state = 0;
+            inc = (sequence_index << 1) | 1;
+            next_uint();
+            state += offset;
+            next_uint();
+        }
+
+        uint32_t next_uint()
+        {
+            uint64_t old_state = state;
+            state = old_state * 6364136223846793005ull + inc;
+            uint32_t xorshifted = (uint32_t)(((old_state >> 18) ^ old_state) >> 27);
+            uint32_t rotation = (uint32_t)(old_state >> 59);
+            return (xorshifted >> rotation) | (xorshifted << ((~rotation + 1) & 31));
+        }
+
+        // Uniform in [0, 1)
+        float next_float()
+        {
+            return fixed_point_to_float(next_uint());
+        }
+
+    private:
+        uint64_t state, inc;
+    };
+
+    // Scrambles the bits of v, to turn neighbouring pixel and sample indices into unrelated seeds
+    inline uint64_t mix_bits(uint64_t v)
+    {
+        v ^= v >> 31;
+        v *= 0x7fb5d329728ea185ull;
+        v ^= v >> 27;
+        v *= 0x81dadef4bc2dd44dull;
+        v ^= v >> 33;
+        return v;
+    }
+}
@@ -0,0 +1,107 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+
+#include <Eigen/Geometry>
+
+namespace raytracer
+{
+    /*
+     *  Lossy encodings used by the compact storage of meshes and BVH nodes.
+     */
+
+    // IEEE 754 half precision, rounded to nearest even. Overflows become infinity.
+    inline uint16_t float_to_half(float f)
+    {
+        uint32_t x;
+        memcpy(&x, &f, sizeof(x));
+        uint16_t sign = (x >> 16) & 0x8000;
+        int exponent = ((x >> 23) & 0xff) - 127 + 15;
+        uint32_t mantissa = x & 0x7fffff;
+
+        if (((x >> 23) & 0xff) == 0xff) // infinity or NaN
+            return sign | 0x7c00 | (mantissa != 0 ? 0x200 : 0);
+        if (exponent >= 31)
+            return sign | 0x7c00;
+        if (exponent <= 0)
+        {
+            // Subnormal, or too small even for that
+            if (exponent < -10)
+                return sign;
+            mantissa |= 0x800000;
+            int shift = 14 - exponent;
+            uint32_t half = mantissa >> shift;
+            uint32_t rest = mantissa & ((1u << shift) - 1), halfway = 1u << (shift - 1);
+            if (rest > halfway || (rest == halfway && (half & 1)))
+                half++;
+            return sign | half;
+        }
+
+        uint32_t half = (exponent << 10) | (mantissa >> 13);
+        uint32_t rest = mantissa & 0x1fff;
+        if (rest > 0x1000 || (rest == 0x1000 && (half & 1)))
+            half++; // may carry into the exponent, which rounds up to the next power of two or to infinity
+        return sign | half;
+    }
+
+    inline float half_to_float(uint16_t h)
+    {
+        uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+        uint32_t exponent = (h >> 10) & 0x1f;
+        uint32_t mantissa = h & 0x3ff;
+        uint32_t x;
+        if (exponent == 0x1f)
+            x = sign | 0x7f800000 | (mantissa << 13);
+        else if (exponent != 0)
+            x = sign | ((exponent - 15 + 127) << 23) | (mantissa << 13);
+        else if (mantissa == 0)
+            x = sign;
+        else
+        {
+            // Subnormal half, normal float
+            exponent = 127 - 15 + 1;
+            while ((mantissa & 0x400) == 0)
+            {
+                mantissa <<= 1;
+                exponent--;
+            }
+            x = sign | (exponent << 23) | ((mantissa & 0x3ff) << 13);
+        }
+        float f;
+        memcpy(&f, &x, sizeof(f));
+        return f;
+    }
+
+    /*
+     *  Unit vectors mapped onto an octahedron, unfolded onto the [-1, 1] square and stored as two
+     *  16 bit fixed point coordinates (Cigolle et al., "A Survey of Efficient Representations for
+     *  Independent Unit Vectors"). The error is below 0.005 degrees.
+     */
+    inline uint32_t encode_octahedral(const Eigen::Vector3f &n)
+    {
+        float l1 = std::fabs(n.x()) + std::fabs(n.y()) + std::fabs(n.z());
+        float x = l1 > 0.0f ? n.x() / l1 : 0.0f, y = l1 > 0.0f ? n.y() / l1 : 0.0f;
+        if (n.z() < 0.0f)
+        {
+            float folded_x = (1.0f - std::fabs(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+            float folded_y = (1.0f - std::fabs(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+            x = folded_x;
+            y = folded_y;
+        }
+        auto quantize = [](float v)
+        { return (uint32_t)std::lround((std::min(std::max(v, -1.0f), 1.0f) * 0.5f + 0.5f) * 65535.0f); };
+        return quantize(x) | (quantize(y) << 16);
+    }
+
+    inline Eigen::Vector3f decode_octahedral(uint32_t encoded)
+    {
+        float x = (encoded & 0xffff) * (2.0f / 65535.0f) - 1.0f;
+        float y = (encoded >> 16) * (2.0f / 65535.0f) - 1.0f;
+        float z = 1.0f - std::fabs(x) - std::fabs(y);
+        float t = std::max(-z, 0.0f);
+        x += x >= 0.0f ? -t : t;
+        y += y >= 0.0f ? -t : t;
+        return Eigen::Vector3f(x, y, z).normalized();
+    }
+}
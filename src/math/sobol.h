@@ -0,0 +1,61 @@
+#pragma once
+#include <cstdint>
+
+#include "pcg32.h"
+
+namespace raytracer
+{
+    /*
+     *  Owen scrambled Sobol points, computed on the fly with the hash based scrambling of Burley,
+     *  "Practical Hash-based Owen Scrambling" (JCGT 2020). Only the first two Sobol dimensions are used,
+     *  which form a (0,2)-sequence; every further pair of dimensions takes them again under another
+     *  scramble and another shuffle of the sample order, so no table of direction numbers is needed.
+     */
+
+    inline uint32_t reverse_bits(uint32_t v)
+    {
+        v = ((v >> 1) & 0x55555555u) | ((v & 0x55555555u) << 1);
+        v = ((v >> 2) & 0x33333333u) | ((v & 0x33333333u) << 2);
+        v = ((v >> 4) & 0x0f0f0f0fu) | ((v & 0x0f0f0f0fu) << 4);
+        v = ((v >> 8) & 0x00ff00ffu) | ((v & 0x00ff00ffu) << 8);
+        return (v >> 16) | (v << 16);
+    }
+
+    // The second Sobol dimension, whose direction numbers are the rows of Pascal's triangle mod 2
+    inline uint32_t sobol_second_dimension(uint32_t index)
+    {
+        uint32_t result = 0;
+        for (uint32_t v = 1u << 31; index != 0; index >>= 1, v ^= v >> 1)
+        {
+            if (index & 1)
+                result ^= v;
+        }
+        return result;
+    }
+
+    // A random permutation of x in which every bit only depends on itself and the bits below it
+    // (the improved hash of Vegdahl, after Laine and Karras)
+    inline uint32_t laine_karras_permutation(uint32_t x, uint32_t seed)
+    {
+        x ^= x * 0x3d20adeau;
+        x += seed;
+        x *= (seed >> 16) | 1;
+        x ^= x * 0x05526c56u;
+        x ^= x * 0x53a22864u;
+        return x;
+    }
+
+    // Owen scrambling of a 32 bit fixed point number in [0, 1): the bits are permuted from the top down
+    inline uint32_t nested_uniform_scramble(uint32_t x, uint32_t seed)
+    {
+        return reverse_bits(laine_karras_permutation(reverse_bits(x), seed));
+    }
+
+    // Point index of the 2D sequence selected by seed, in [0, 1)^2
+    inline void sobol_2d(uint32_t index, uint32_t seed, float &x, float &y)
+    {
+        index = nested_uniform_scramble(index, seed);
+        x = fixed_point_to_float(nested_uniform_scramble(reverse_bits(index), (uint32_t)mix_bits(seed)));
+        y = fixed_point_to_float(nested_uniform_scramble(sobol_second_dimension(index), (uint32_t)mix_bits(seed ^ 0x9e3779b9u)));
+    }
+}
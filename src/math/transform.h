@@ -1,8 +1,14 @@
 #pragma once
 #include "utilities.h"
+#include "ray.h"
 
 namespace raytracer
 {
+    /*
+     *  An affine transform, stored as a 4x4 matrix together with its inverse.
+     *  The 3x4 parts actually used to transform points, vectors and normals (and their
+     *  inverses) are extracted once on construction, so nothing is inverted per ray.
+     */
     class Transform
     {
     public:
@@ -10,18 +16,21 @@ namespace raytracer
         {
             m = Eigen::Matrix4f::Identity();
             inv_m = Eigen::Matrix4f::Identity();
+            cache();
         }
 
         Transform(const Eigen::Matrix4f matrix)
         {
             m = matrix;
             inv_m = matrix.inverse();
+            cache();
         }
 
         Transform(const Eigen::Matrix4f &matrix, const Eigen::Matrix4f &inv_matrix)
         {
             m = matrix;
             inv_m = inv_matrix;
+            cache();
         }
 
         Transform operator*(const Transform &t2) const
@@ -31,7 +40,12 @@ namespace raytracer
 
         static Transform Inverse(const Transform &t)
         {
-            return Transform(t.inv_m, t.m);
+            Transform inv = t;
+            std::swap(inv.m, inv.inv_m);
+            std::swap(inv.linear, inv.inv_linear);
+            std::swap(inv.translation, inv.inv_translation);
+            inv.normal_matrix = inv.inv_linear.transpose();
+            return inv;
         }
 
         static Transform Transpose(const Transform &t)
@@ -98,64 +112,73 @@ namespace raytracer
             return Transform(mm, mm.transpose());
         }
 
-        Eigen::Vector3f transform_point(const Eigen::Vector3f &p)
+        Eigen::Vector3f transform_point(const Eigen::Vector3f &p) const
         {
-            // std::cout << p << "\n\n";
-            Eigen::Transform<float, 3, Eigen::Affine> affineTransform(m);
-            return affineTransform * p;
+            return linear * p + translation;
         }
 
-        Eigen::Vector3f transform_vector(const Eigen::Vector3f &v)
+        Eigen::Vector3f transform_vector(const Eigen::Vector3f &v) const
         {
-            Eigen::Transform<float, 3, Eigen::Affine> affineTransform(m);
-            return affineTransform.linear() * v;
-            // Eigen::Vector3f tv;
-            // tv << m(0, 0) * v.x() + m(0, 1) + v.y(), m(0, 2) + v.z(),
-            //     m(1, 0) * v.x() + m(1, 1) * v.y() + m(1, 2) * v.z(),
-            //     m(2, 0) * v.x() + m(2, 1) * v.y() + m(2, 2) * v.z();
-            // return tv;
+            return linear * v;
         }
 
-        Eigen::Vector3f transform_normal(const Eigen::Vector3f &n)
+        // Normals are transformed by the inverse transpose, and renormalized
+        Eigen::Vector3f transform_normal(const Eigen::Vector3f &n) const
         {
-            Eigen::Transform<float, 3, Eigen::Affine> affineTransform(m);
-            Eigen::Matrix3f normal_matrix = affineTransform.linear().inverse().transpose();
             return (normal_matrix * n).normalized();
-            // Eigen::Vector3f tn;
-            // tn << inv_m(0, 0) * n.x() + inv_m(1, 0) * n.y() + inv_m(2, 0) * n.z(),
-            //       inv_m(0, 1) * n.x() + inv_m(1, 1) * n.y() + inv_m(2, 1) * n.z(),
-            //       inv_m(0, 2) * n.x() + inv_m(1, 2) * n.y() + inv_m(2, 2) * n.z();
-            // return tn.normalized();
         }
 
-        Eigen::AlignedBox3f transform_bounding_box(const Eigen::AlignedBox3f &b)
+        // The direction is not normalized, so distances along the ray stay the same in both spaces
+        Ray transform_ray(const Ray &r) const
         {
-            // Initialize an array to store the transformed corner points
-            Eigen::Vector3f corners[8];
+            Ray tr(transform_point(r.origin), transform_vector(r.direction));
+            tr.is_camera_ray = r.is_camera_ray;
+            return tr;
+        }
 
-            // Transform each of the eight corners
-            for (int i = 0; i < 8; ++i)
-            {
-                Eigen::Vector3f corner = b.corner((Eigen::AlignedBox3f::CornerType)i);
-                corners[i] = this->transform_point(corner);
-            }
+        Eigen::Vector3f inverse_transform_point(const Eigen::Vector3f &p) const
+        {
+            return inv_linear * p + inv_translation;
+        }
 
-            // Compute the minimum and maximum coordinates of the transformed corner points
-            Eigen::Vector3f minCoords = corners[0];
-            Eigen::Vector3f maxCoords = corners[0];
+        Eigen::Vector3f inverse_transform_vector(const Eigen::Vector3f &v) const
+        {
+            return inv_linear * v;
+        }
 
-            for (int i = 1; i < 8; ++i)
-            {
-                minCoords = minCoords.cwiseMin(corners[i]);
-                maxCoords = maxCoords.cwiseMax(corners[i]);
-            }
+        Ray inverse_transform_ray(const Ray &r) const
+        {
+            Ray tr(inverse_transform_point(r.origin), inverse_transform_vector(r.direction));
+            tr.is_camera_ray = r.is_camera_ray;
+            return tr;
+        }
 
-            // Reconstruct the transformed bounding box
-            Eigen::AlignedBox3f tb(minCoords, maxCoords);
-            return tb;
+        Eigen::AlignedBox3f transform_bounding_box(const Eigen::AlignedBox3f &b) const
+        {
+            if (b.isEmpty())
+                return b;
+
+            // Instead of transforming the eight corners, transform the center and
+            // project the half extents onto each axis (Arvo, Graphics Gems)
+            Eigen::Vector3f center = transform_point(b.center());
+            Eigen::Vector3f half_extent = linear.cwiseAbs() * (0.5f * b.sizes());
+            return Eigen::AlignedBox3f(center - half_extent, center + half_extent);
         }
 
     private:
         Eigen::Matrix4f m, inv_m;
+
+        // The affine parts of m and inv_m, and the inverse transpose used for normals
+        Eigen::Matrix3f linear, inv_linear, normal_matrix;
+        Eigen::Vector3f translation, inv_translation;
+
+        void cache()
+        {
+            linear = m.topLeftCorner<3, 3>();
+            translation = m.topRightCorner<3, 1>();
+            inv_linear = inv_m.topLeftCorner<3, 3>();
+            inv_translation = inv_m.topRightCorner<3, 1>();
+            normal_matrix = inv_linear.transpose();
+        }
     };
 }
\ No newline at end of file
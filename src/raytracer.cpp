@@ -8,11 +8,15 @@
 
 #include "gui.h"
 #include "clock_util.h"
+#include "film.h"
+#include "thread_pool.h"
+#include "tile_scheduler.h"
 #include "utilities.h"
 #include "console.h"
 #include "renderview.h"
 #include "multijittered.h"
 #include "pure_random.h"
+#include "sobol_sampler.h"
 #include "materials.h"
 #include "pinhole.h"
 #include "path_tracer.h"
@@ -22,7 +26,10 @@
 #include "sphere.h"
 #include "rectangle.h"
 #include "obj_loader.h"
-#include "mesh_triangle.h"
+#include "triangle_mesh.h"
+#include "instance.h"
+#include "bvh_cache.h"
+#include "streamed_mesh.h"
 #include "directional.h"
 #include "point_light.h"
 #include "emissive.h"
@@ -36,7 +43,7 @@ using namespace raytracer;
 const auto aspect_ratio = 16.0 / 9.0;
 const int image_width = 1920;
 const int image_height = static_cast<int>(image_width / aspect_ratio);
-const int samples_per_pixel = 300;
+int samples_per_pixel = 300;
 const int max_depth = 10;
 
 // World
@@ -49,39 +56,127 @@ std::shared_ptr<Sampler> sampler = nullptr;
 std::shared_ptr<Tracer> tracer = nullptr;
 
 // BVH
-std::shared_ptr<BVH_Node> bvh = nullptr;
+std::shared_ptr<BVH> bvh = nullptr;
 
-unsigned int num_threads = std::thread::hardware_concurrency() - 1;
+// Quantized meshes and BVH nodes, for scenes that barely fit in memory. Turned on with --compact.
+bool compact_geometry = false;
+
+// Out of core mesh, whose cluster cache statistics are logged after the render
+std::shared_ptr<StreamedMesh> streamed_mesh = nullptr;
+
+// Render threads, one hardware thread is left for the GUI. Can be changed with --threads N.
+unsigned int num_threads = std::max(2u, std::thread::hardware_concurrency()) - 1;
+
+// The image is rendered in square tiles of this many pixels, handed out to the threads as they go
+const int tile_size = 32;
+const TileOrder tile_order = SPIRAL;
+
+// The image is refined in passes over all of it, each adding this many samples to every pixel, so the
+// whole frame can be previewed early on. Setting it to samples_per_pixel renders in a single pass.
+// Can be changed with --samples-per-pass N.
+int samples_per_pass = 1;
+
+// Stop adding passes after this many seconds, 0 for no limit. Can be changed with --time SECONDS.
+double time_budget_seconds = 0;
+std::chrono::steady_clock::time_point render_deadline;
+
+// The running sums of the samples, which the preview and the saved image are made from
+Film film(image_width, image_height);
 
 std::atomic<bool> exit_requested(false);
+std::atomic<bool> stop_requested(false); // set by the viewport's stop button, keeps what was rendered
+
+static bool render_stopped()
+{
+    if (exit_requested.load(std::memory_order_relaxed) || stop_requested.load(std::memory_order_relaxed))
+        return true;
+    return time_budget_seconds > 0 && std::chrono::steady_clock::now() >= render_deadline;
+}
+
+// Camera rays are traced in packets covering blocks of packet_size x packet_size neighbouring pixels
+const int packet_size = 4;
+static_assert(packet_size * packet_size <= RayPacket::max_size, "A pixel block must fit in a ray packet");
 
-void render_region(Eigen::Vector2f top_left, unsigned int width, unsigned int height)
+// Adds samples [first_sample, first_sample + nr_samples) of every pixel of the tile to the film and
+// updates the preview. Returns false if the render was stopped, after adding the samples finished so far.
+bool render_tile(const Tile &tile, int first_sample, int nr_samples, std::vector<HitInfo> &recs)
 {
     // ZoneScoped;
-    for (int i = top_left.y(); i < top_left.y() + height; ++i)
+    int end_i = tile.y + tile.height, end_j = tile.x + tile.width;
+    double pixel_size = world.camera->get_pixel_size();
+
+    for (int block_i = tile.y; block_i < end_i; block_i += packet_size)
     {
-        for (int j = top_left.x(); j < top_left.x() + width; ++j)
+        for (int block_j = tile.x; block_j < end_j; block_j += packet_size)
         {
-            Color pixel_color(0, 0, 0);
-            for (int s = 0; s < samples_per_pixel; s++)
+            int rows = std::min(packet_size, end_i - block_i);
+            int cols = std::min(packet_size, end_j - block_j);
+            Color pixel_colors[RayPacket::max_size];
+            for (int k = 0; k < rows * cols; k++)
+                pixel_colors[k] = Color(0, 0, 0);
+
+            int end_sample = first_sample + nr_samples;
+            int s = first_sample;
+            for (; s < end_sample; s++)
             {
-                // Gracefully kill this thread
-                if (exit_requested.load(std::memory_order_relaxed))
-                    return;
-                Eigen::Vector2f p = sampler->sample_unit_square();
-                double pixel_size = world.camera->get_pixel_size();
-                auto u = pixel_size * (j - 0.5 * image_width + p.x());
-                auto v = pixel_size * (i - 0.5 * image_height + p.y());
-                Ray r = world.camera->get_ray(Eigen::Vector2f(u, v));
-                r.is_camera_ray = true;
-
-                pixel_color += tracer->trace_ray(r, world, max_depth);
+                // Gracefully stop this thread
+                if (render_stopped())
+                    break;
+
+                // Every pixel sample goes on from where its camera ray left the sampling context
+                RayPacket packet;
+                SamplingContext &context = SamplingContext::current();
+                SamplingContext pixel_contexts[RayPacket::max_size];
+                for (int k = 0; k < rows * cols; k++)
+                {
+                    int i = block_i + k / cols, j = block_j + k % cols;
+                    context.start_pixel_sample(j, i, s);
+                    Eigen::Vector2f p = sampler->sample_unit_square();
+                    auto u = pixel_size * (j - 0.5 * image_width + p.x());
+                    auto v = pixel_size * (i - 0.5 * image_height + p.y());
+                    Ray r = world.camera->get_ray(Eigen::Vector2f(u, v));
+                    r.is_camera_ray = true;
+                    packet.add(r, Interval(0.0001, infinity));
+                    pixel_contexts[k] = context;
+                }
+
+                int hit_mask = world.hit_objects_packet(packet, recs.data());
+                for (int k = 0; k < rows * cols; k++)
+                {
+                    context = pixel_contexts[k];
+                    pixel_colors[k] += tracer->trace_hit(packet.rays[k], recs[k], (hit_mask >> k) & 1, world, max_depth);
+                }
             }
-            pixel_color = Clamp((pixel_color / samples_per_pixel), 0.0, 1.0).gamma_corrected() * 255.0;
 
-            RenderView::GetInstance()->set_pixel_color(image_height - i - 1, j, pixel_color);
+            for (int k = 0; k < rows * cols && s > first_sample; k++)
+            {
+                int i = block_i + k / cols, j = block_j + k % cols;
+                film.add_samples(i, j, pixel_colors[k], s - first_sample);
+                RenderView::GetInstance()->set_pixel_color(image_height - i - 1, j, film.display_color(i, j));
+            }
+            if (s < end_sample)
+                return false;
         }
     }
+    return true;
+}
+
+void render_worker(TileScheduler *scheduler, int thread)
+{
+    std::vector<HitInfo> recs;
+    for (int k = 0; k < RayPacket::max_size; k++)
+        recs.emplace_back(world);
+
+    Tile tile;
+    int pass;
+    while (scheduler->next_tile(thread, tile, pass))
+    {
+        // Another thread may still be rendering the previous pass of this tile
+        std::lock_guard<std::mutex> lock(scheduler->tile_mutex(tile));
+        int first_sample = pass * samples_per_pass;
+        if (!render_tile(tile, first_sample, std::min(samples_per_pass, samples_per_pixel - first_sample), recs))
+            return;
+    }
 }
 
 void test()
@@ -121,10 +216,10 @@ void test()
     world.set_camera(camera);
 
     // Sampler
-    sampler = std::make_shared<MultiJittered>(100);
+    sampler = std::make_shared<SobolSampler>();
 
     Console::GetInstance()->addLogEntry("Constructing BVH...");
-    bvh = std::make_shared<BVH_Node>(world.objects);
+    bvh = std::make_shared<BVH>(world.objects);
     world.objects.clear();
     world.objects.push_back(bvh);
 
@@ -151,23 +246,9 @@ void knob_test()
     if (loaded)
     {
 
-        auto floor_mesh = create_triangle_mesh(attrib, shapes[0], ShadingType::SMOOTH, floor, nullptr);
-        for (int i = 0; i < floor_mesh.size(); i++)
-        {
-            world.add_object(floor_mesh[i]);
-        }
-
-        auto outer_mesh = create_triangle_mesh(attrib, shapes[1], ShadingType::SMOOTH, outer, nullptr);
-        for (int i = 0; i < outer_mesh.size(); i++)
-        {
-            world.add_object(outer_mesh[i]);
-        }
-
-        auto inner_mesh = create_triangle_mesh(attrib, shapes[2], ShadingType::SMOOTH, inner, nullptr);
-        for (int i = 0; i < inner_mesh.size(); i++)
-        {
-            world.add_object(inner_mesh[i]);
-        }
+        world.add_object(load_triangle_mesh(attrib, shapes[0], ShadingType::SMOOTH, {floor}, nullptr, compact_geometry));
+        world.add_object(load_triangle_mesh(attrib, shapes[1], ShadingType::SMOOTH, {outer}, nullptr, compact_geometry));
+        world.add_object(load_triangle_mesh(attrib, shapes[2], ShadingType::SMOOTH, {inner}, nullptr, compact_geometry));
     }
 
     // Camera
@@ -178,10 +259,12 @@ void knob_test()
     world.set_camera(camera);
 
     // Anti Aliasing Sampler
-    sampler = std::make_shared<MultiJittered>(100);
+    sampler = std::make_shared<SobolSampler>();
 
     Console::GetInstance()->addLogEntry("Constructing BVH...");
-    bvh = std::make_shared<BVH_Node>(world.objects);
+    BVHBuildParams params;
+    params.compact = compact_geometry;
+    bvh = std::make_shared<BVH>(world.objects, params);
     world.objects.clear();
     world.objects.push_back(bvh);
 
@@ -210,6 +293,7 @@ void cornell_box()
 
     auto area_light = std::make_shared<AreaLight>();
     area_light->set_object(light_rect);
+    area_light->num_samples = 8; // soft shadows, traced as a packet of 8 shadow rays
     world.add_light(area_light);
 
     world.add_object(std::make_shared<Rectangle>(Eigen::Vector3f(780, 0, 0), Eigen::Vector3f(0, 0, 555), Eigen::Vector3f(0, 555, 0), green));
@@ -256,10 +340,10 @@ void cornell_box()
     world.set_camera(camera);
 
     // Sampler
-    sampler = std::make_shared<MultiJittered>(100);
+    sampler = std::make_shared<SobolSampler>();
 
     Console::GetInstance()->addLogEntry("Constructing BVH...");
-    bvh = std::make_shared<BVH_Node>(world.objects);
+    bvh = std::make_shared<BVH>(world.objects);
     world.objects.clear();
     world.objects.push_back(bvh);
 
@@ -279,11 +363,7 @@ void setup4()
 
     if (loaded)
     {
-        auto triangles = create_triangle_mesh(attrib, shapes[0], ShadingType::SMOOTH, mat, nullptr);
-        for (int i = 0; i < triangles.size(); i++)
-        {
-            world.add_object(triangles[i]);
-        }
+        world.add_object(load_triangle_mesh(attrib, shapes[0], ShadingType::SMOOTH, {mat}, nullptr));
     }
 
     world.add_object(std::make_shared<Sphere>(Eigen::Vector3f(-3.0, 0.0, 0.0), 1.0, mat));
@@ -303,10 +383,10 @@ void setup4()
     world.set_camera(camera);
 
     // Anti Aliasing Sampler
-    sampler = std::make_shared<MultiJittered>(100);
+    sampler = std::make_shared<SobolSampler>();
 
     Console::GetInstance()->addLogEntry("Constructing BVH...");
-    auto bvh = std::make_shared<BVH_Node>(world.objects);
+    auto bvh = std::make_shared<BVH>(world.objects);
     world.objects.clear();
     world.objects.push_back(bvh);
 
@@ -318,25 +398,77 @@ void setup4()
     RenderView::GetInstance()->display_render = true;
 }
 
-void setup3()
+void instancing_test()
 {
-    // ZoneScoped;
-    auto mat = std::make_shared<Matte>(1, Color::grey);
+    world.hdri = std::make_shared<ImageTexture>(std::make_unique<UVMapping>(), "../src/hdri.png");
 
     tinyobj::attrib_t attrib;
     std::vector<tinyobj::shape_t> shapes;
     std::vector<tinyobj::material_t> materials;
-    bool loaded = LoadObj("../models/bucatarie/buc2.obj", attrib, shapes, materials);
+    bool loaded = LoadObj("../models/bunny/bunny.obj", attrib, shapes, materials);
+
+    BVHBuildParams params;
+    params.compact = compact_geometry;
 
     if (loaded)
     {
-        auto triangles = create_triangle_mesh(attrib, shapes[0], ShadingType::FLAT, mat, nullptr);
-        for (int i = 0; i < triangles.size(); i++)
+        // The bunny and its BVH are built once and shared by every instance
+        std::vector<std::shared_ptr<GeometricObject>> bunny_objects = {load_triangle_mesh(attrib, shapes[0], ShadingType::SMOOTH, {nullptr}, nullptr, compact_geometry)};
+        auto bunny = std::make_shared<BVH>(bunny_objects, params);
+
+        for (int a = -10; a < 10; a++)
         {
-            world.add_object(triangles[i]);
+            for (int b = -10; b < 10; b++)
+            {
+                Transform *t = new Transform;
+                *t = Transform::Translate(Eigen::Vector3f(a, -0.35, b)) * Transform::RotateY(random_float(0, 360)) * Transform::Scale(Eigen::Vector3f(4, 4, 4));
+                auto instance = std::make_shared<Instance>(bunny, t);
+                instance->material = std::make_shared<Matte>(1.0, Color(random_float(), random_float(), random_float()));
+                world.add_object(instance);
+            }
         }
     }
 
+    auto material_ground = std::make_shared<Matte>(0.8, Color(0.5, 0.5, 0.5));
+    world.add_object(std::make_shared<Rectangle>(Eigen::Vector3f(-200, -0.2, -200), Eigen::Vector3f(400, 0, 0), Eigen::Vector3f(0, 0, 400), Eigen::Vector3f(0, 1.0, 0.0), material_ground));
+
+    // Camera
+    std::shared_ptr<Pinhole> camera = std::make_shared<Pinhole>(Eigen::Vector3f(14, 6, 14), Eigen::Vector3f(0, 0, 0));
+    camera->set_fov(40);
+    camera->compute_pixel_size(image_width, image_height);
+    camera->compute_uvw();
+    world.set_camera(camera);
+
+    // Anti Aliasing Sampler
+    sampler = std::make_shared<SobolSampler>();
+
+    // The top level BVH, over the instances
+    Console::GetInstance()->addLogEntry("Constructing BVH...");
+    bvh = std::make_shared<BVH>(world.objects, params);
+    world.objects.clear();
+    world.objects.push_back(bvh);
+
+    // Tracer
+    tracer = std::make_shared<PathTracer>();
+
+    // Start viewport preview
+    RenderView::GetInstance()->set_size(image_width, image_height);
+    RenderView::GetInstance()->display_render = true;
+}
+
+void setup3()
+{
+    // ZoneScoped;
+    auto mat = std::make_shared<Matte>(1, Color::grey);
+
+    // The kitchen is heavy, so its BVH is cached on disk between runs.
+    // Spatial splits help with its long, thin triangles.
+    BVHBuildParams params;
+    params.method = SBVH;
+    auto kitchen = load_mesh_bvh("../models/bucatarie/buc2.obj", 0, ShadingType::FLAT, mat, params);
+    if (kitchen != nullptr)
+        world.add_object(kitchen);
+
     auto light_mat = std::make_shared<Emissive>(15.0, Color::white);
     auto light_rect = std::make_shared<Rectangle>(Eigen::Vector3f(-18, 250, -242), Eigen::Vector3f(-100, 0, 0), Eigen::Vector3f(0, 0, -100), light_mat);
     world.add_object(light_rect);
@@ -353,17 +485,59 @@ void setup3()
     world.set_camera(camera);
 
     // Construct the BVH
-    HiResTimer timer;
     Console::GetInstance()->addLogEntry("Constructing BVH...");
-    timer.start();
-    auto bvh = std::make_shared<BVH_Node>(world.objects);
+    auto bvh = std::make_shared<BVH>(world.objects);
     world.objects.clear();
     world.objects.push_back(bvh);
-    timer.stop();
-    Console::GetInstance()->addSuccesEntry("BVH built in " + std::to_string(timer.elapsed_time_milliseconds()) + " ms.");
 
     // Anti Aliasing Sampler
-    sampler = std::make_shared<MultiJittered>(100);
+    sampler = std::make_shared<SobolSampler>();
+
+    // Tracer
+    tracer = std::make_shared<PathTracer>();
+    world.tracer = tracer;
+
+    // Start viewport preview
+    RenderView::GetInstance()->set_size(image_width, image_height);
+    RenderView::GetInstance()->display_render = true;
+}
+
+void streaming_test()
+{
+    // ZoneScoped;
+    auto mat = std::make_shared<Matte>(1, Color::grey);
+
+    // The kitchen again, this time kept on disk in clusters of which at most 64 MB are in memory
+    StreamingParams params;
+    params.cluster_size = 4096;
+    params.max_resident_bytes = 64ull << 20;
+    streamed_mesh = load_streamed_mesh("../models/bucatarie/buc2.obj", 0, ShadingType::FLAT, mat, params);
+    if (streamed_mesh != nullptr)
+        world.add_object(streamed_mesh);
+
+    auto light_mat = std::make_shared<Emissive>(15.0, Color::white);
+    auto light_rect = std::make_shared<Rectangle>(Eigen::Vector3f(-18, 250, -242), Eigen::Vector3f(-100, 0, 0), Eigen::Vector3f(0, 0, -100), light_mat);
+    world.add_object(light_rect);
+
+    auto area_light = std::make_shared<AreaLight>();
+    area_light->set_object(light_rect);
+    world.add_light(area_light);
+
+    // Camera
+    std::shared_ptr<Pinhole> camera = std::make_shared<Pinhole>(Eigen::Vector3f(163, 187, -730), Eigen::Vector3f(-18, 104, -242));
+    camera->set_fov(20);
+    camera->compute_pixel_size(image_width, image_height);
+    camera->compute_uvw();
+    world.set_camera(camera);
+
+    // The BVH over the clusters only needs their bounds, no cluster is loaded to build it
+    Console::GetInstance()->addLogEntry("Constructing BVH...");
+    auto bvh = std::make_shared<BVH>(world.objects);
+    world.objects.clear();
+    world.objects.push_back(bvh);
+
+    // Anti Aliasing Sampler
+    sampler = std::make_shared<SobolSampler>();
 
     // Tracer
     tracer = std::make_shared<PathTracer>();
@@ -463,12 +637,12 @@ void setup2()
     world.set_camera(camera);
 
     // Construct the BVH
-    auto bvh = std::make_shared<BVH_Node>(world.objects);
+    auto bvh = std::make_shared<BVH>(world.objects);
     world.objects.clear();
     world.objects.push_back(bvh);
 
     // Anti Aliasing Sampler
-    sampler = std::make_shared<MultiJittered>(100);
+    sampler = std::make_shared<SobolSampler>();
 
     // Start viewport preview
     RenderView::GetInstance()->set_size(image_width, image_height);
@@ -489,11 +663,7 @@ void setup()
 
     Transform *bunny_transform = new Transform;
     *bunny_transform = Transform::Translate(Eigen::Vector3f(7, -0.5, 2)) * Transform::Scale(Eigen::Vector3f(10, 10, 10));
-    auto triangles = raytracer::create_triangle_mesh(attrib, shapes[0], ShadingType::FLAT, mat, bunny_transform);
-    for (int i = 0; i < triangles.size(); i++)
-    {
-        world.add_object(triangles[i]);
-    }
+    world.add_object(load_triangle_mesh(attrib, shapes[0], ShadingType::FLAT, {mat}, bunny_transform));
 
     auto material_ground = std::make_shared<Matte>(0.8, Color(0.5, 0.5, 0.5));
     world.add_object(std::make_shared<Rectangle>(Eigen::Vector3f(-200, 0, -200), Eigen::Vector3f(400, 0, 0), Eigen::Vector3f(0, 0, 400), Eigen::Vector3f(0, 1.0, 0.0), material_ground));
@@ -550,17 +720,13 @@ void setup()
     camera->compute_uvw();
     world.set_camera(camera);
 
-    HiResTimer timer;
     Console::GetInstance()->addLogEntry("Constructing BVH...");
-    timer.start();
-    bvh = std::make_shared<BVH_Node>(world.objects);
+    bvh = std::make_shared<BVH>(world.objects);
     world.objects.clear();
     world.objects.push_back(bvh);
-    timer.stop();
-    Console::GetInstance()->addSuccesEntry("BVH built in " + std::to_string(timer.elapsed_time_milliseconds()) + " ms.");
 
     // Anti Aliasing Sampler
-    sampler = std::make_shared<MultiJittered>(100);
+    sampler = std::make_shared<SobolSampler>();
 
     // Start viewport preview
     RenderView::GetInstance()->set_size(image_width, image_height);
@@ -593,26 +759,32 @@ void multi_threaded_render()
     if (bvh == nullptr)
         Console::GetInstance()->addWarningEntry("[Warning] No Bounding Volume Hierarchy found. Rendering performance will be severely affected!");
 
-    Console::GetInstance()->addLogEntry("Rendering...");
+    samples_per_pass = std::max(1, std::min(samples_per_pass, samples_per_pixel));
+    int nr_passes = (samples_per_pixel + samples_per_pass - 1) / samples_per_pass;
+    RenderView::GetInstance()->nr_passes = nr_passes;
+    render_deadline = std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(time_budget_seconds));
+
+    Console::GetInstance()->addLogEntry("Rendering " + std::to_string(samples_per_pixel) + " samples per pixel in " + std::to_string(nr_passes) + " passes on " + std::to_string(num_threads) + " threads...");
+    TileScheduler scheduler(image_width, image_height, tile_size, num_threads, nr_passes, tile_order);
     std::vector<std::thread> threads;
-    unsigned int region_width = image_width / num_threads;
-    for (int i = 0; i < num_threads; ++i)
-    {
-        Eigen::Vector2f top_left(i * region_width, 0);
-        unsigned int width = (i == num_threads - 1) ? (image_width - top_left.x()) : region_width;
-        threads.emplace_back(render_region, top_left, width, image_height);
-    }
+    for (int i = 0; i < (int)num_threads; ++i)
+        threads.emplace_back(render_worker, &scheduler, i);
 
     for (auto &thread : threads)
     {
         thread.join();
     }
 
-    if (exit_requested.load(std::memory_order_relaxed))
-        return;
-
     timer.stop();
-    Console::GetInstance()->addEmptyLine()->addSuccesEntry("Render finished! Elapsed time: " + std::to_string(timer.elapsed_time_seconds()) + " seconds.");
+    int min_samples, max_samples;
+    film.sample_count_range(min_samples, max_samples);
+    if (min_samples < samples_per_pixel)
+        Console::GetInstance()->addEmptyLine()->addWarningEntry("Render stopped early with " + std::to_string(min_samples) + " to " + std::to_string(max_samples) + " samples per pixel. Elapsed time: " + std::to_string(timer.elapsed_time_seconds()) + " seconds.");
+    else
+        Console::GetInstance()->addEmptyLine()->addSuccesEntry("Render finished! Elapsed time: " + std::to_string(timer.elapsed_time_seconds()) + " seconds.");
+    Console::GetInstance()->addLogEntry(std::to_string(scheduler.stolen_count()) + " of the tiles were stolen to balance the threads");
+    if (streamed_mesh != nullptr)
+        streamed_mesh->cache().log_statistics("the streamed mesh");
 
     FILE *output_file = fopen("../output.png", "wb");
     int result = BufferedImage::save_image_png(*(RenderView::GetInstance()->image), output_file);
@@ -627,10 +799,26 @@ void multi_threaded_render()
     RenderView::GetInstance()->finished = true;
 }
 
-int main()
+int main(int argc, char **argv)
 {
     Console::GetInstance()->addLogEntry("A WIP ray tracer with minimal UI elements")->addLogEntry("Version 0.1.1-alpha")->addLogEntry("--- Made by Vlad Chira ---")->addEmptyLine();
 
+    for (int i = 1; i < argc; i++)
+    {
+        std::string option = argv[i];
+        const char *value = i + 1 < argc ? argv[i + 1] : "";
+        if (option == "--compact")
+            compact_geometry = true;
+        else if (option == "--threads" && atoi(value) > 0)
+            num_threads = atoi(argv[++i]);
+        else if (option == "--samples" && atoi(value) > 0)
+            samples_per_pixel = atoi(argv[++i]);
+        else if (option == "--samples-per-pass" && atoi(value) > 0)
+            samples_per_pass = atoi(argv[++i]);
+        else if (option == "--time" && atof(value) > 0)
+            time_budget_seconds = atof(argv[++i]);
+    }
+
     GUI gui;
     gui.init();
 
@@ -640,6 +828,7 @@ int main()
 
     render_thread.join();
 
+    ThreadPool::DestroyInstance();
     Console::GetInstance()->DestroyInstance();
     return 0;
 }
@@ -0,0 +1,69 @@
+#include "mapped_file.h"
+
+#include <fstream>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define RT_HAS_MMAP
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+MappedFile::~MappedFile()
+{
+    close();
+}
+
+bool MappedFile::open(const std::string &filename)
+{
+    close();
+#ifdef RT_HAS_MMAP
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0)
+    {
+        ::close(fd);
+        return false;
+    }
+
+    void *p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // The mapping stays valid after the descriptor is closed
+    ::close(fd);
+    if (p == MAP_FAILED)
+        return false;
+
+    data_ptr = static_cast<const unsigned char *>(p);
+    file_size = st.st_size;
+    return true;
+#else
+    std::ifstream in(filename, std::ios::binary | std::ios::ate);
+    if (!in)
+        return false;
+    std::streamsize n = in.tellg();
+    if (n <= 0)
+        return false;
+    buffer.resize(n);
+    in.seekg(0);
+    if (!in.read(reinterpret_cast<char *>(buffer.data()), n))
+        return false;
+
+    data_ptr = buffer.data();
+    file_size = n;
+    return true;
+#endif
+}
+
+void MappedFile::close()
+{
+#ifdef RT_HAS_MMAP
+    if (data_ptr != nullptr)
+        munmap(const_cast<unsigned char *>(data_ptr), file_size);
+#endif
+    buffer.clear();
+    data_ptr = nullptr;
+    file_size = 0;
+}
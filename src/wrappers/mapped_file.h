@@ -0,0 +1,32 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <cstddef>
+
+/*
+ *  A read-only view of a whole file. The file is memory mapped where the platform supports it,
+ *  so only the pages actually touched are read from disk, otherwise it is read into memory.
+ */
+class MappedFile
+{
+private:
+    const unsigned char *data_ptr = nullptr;
+    size_t file_size = 0;
+    std::vector<unsigned char> buffer; // fallback when mmap is unavailable
+
+public:
+    MappedFile() {}
+    ~MappedFile();
+
+    MappedFile(MappedFile &other) = delete;
+    void operator=(const MappedFile &) = delete;
+
+    // Returns false if the file could not be opened
+    bool open(const std::string &filename);
+
+    void close();
+
+    const unsigned char *data() const { return data_ptr; }
+    size_t size() const { return file_size; }
+    bool is_open() const { return data_ptr != nullptr; }
+};
@@ -0,0 +1,80 @@
+#include "thread_pool.h"
+
+ThreadPool *ThreadPool::pool_instance{nullptr};
+std::mutex ThreadPool::singleton_mutex;
+
+ThreadPool::ThreadPool(unsigned int num_threads)
+{
+    for (unsigned int i = 0; i < num_threads; i++)
+        workers.emplace_back(&ThreadPool::worker_loop, this);
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        stopping = true;
+    }
+    queue_cv.notify_all();
+    for (auto &worker : workers)
+        worker.join();
+}
+
+ThreadPool *ThreadPool::GetInstance()
+{
+    std::lock_guard<std::mutex> lock(singleton_mutex);
+    if (pool_instance == nullptr)
+    {
+        pool_instance = new ThreadPool(std::max(1u, std::thread::hardware_concurrency()));
+    }
+    return pool_instance;
+}
+
+void ThreadPool::DestroyInstance()
+{
+    delete pool_instance;
+    pool_instance = NULL;
+}
+
+void ThreadPool::worker_loop()
+{
+    while (true)
+    {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(queue_mutex);
+            queue_cv.wait(lock, [this]
+                          { return stopping || !tasks.empty(); });
+            if (stopping && tasks.empty())
+                return;
+            task = std::move(tasks.front());
+            tasks.pop_front();
+        }
+        task();
+    }
+}
+
+bool ThreadPool::run_pending_task()
+{
+    std::function<void()> task;
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        if (tasks.empty())
+            return false;
+        task = std::move(tasks.back()); // the most recent task is the most likely to be a subtask of ours
+        tasks.pop_back();
+    }
+    task();
+    return true;
+}
+
+void ThreadPool::wait(std::future<void> &result)
+{
+    while (result.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+    {
+        // Nothing left to help with, the task is running on another thread
+        if (!run_pending_task())
+            result.wait_for(std::chrono::microseconds(100));
+    }
+    result.get();
+}
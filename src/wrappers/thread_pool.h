@@ -0,0 +1,92 @@
+#pragma once
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <vector>
+#include <future>
+#include <functional>
+#include <memory>
+#include <algorithm>
+
+/*
+ *  A fixed set of worker threads executing tasks from a shared queue.
+ *  A thread waiting for a task to finish runs other queued tasks in the meantime,
+ *  so tasks can safely submit and wait for subtasks (e.g. recursive builds).
+ */
+class ThreadPool
+{
+private:
+    static ThreadPool *pool_instance;
+    static std::mutex singleton_mutex;
+
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> tasks;
+    std::mutex queue_mutex;
+    std::condition_variable queue_cv;
+    bool stopping = false;
+
+    void worker_loop();
+
+    // Runs one queued task on the calling thread. Returns false if the queue was empty.
+    bool run_pending_task();
+
+public:
+    explicit ThreadPool(unsigned int num_threads);
+    ~ThreadPool();
+
+    ThreadPool(ThreadPool &other) = delete;
+    void operator=(const ThreadPool &) = delete;
+
+    // The pool shared by the whole application, with one worker per hardware thread
+    static ThreadPool *GetInstance();
+
+    static void DestroyInstance();
+
+    unsigned int size() const { return workers.size(); }
+
+    template <typename F>
+    std::future<void> submit(F f)
+    {
+        auto task = std::make_shared<std::packaged_task<void()>>(std::move(f));
+        std::future<void> result = task->get_future();
+        {
+            std::lock_guard<std::mutex> lock(queue_mutex);
+            tasks.emplace_back([task]
+                               { (*task)(); });
+        }
+        queue_cv.notify_one();
+        return result;
+    }
+
+    // Waits for a submitted task, helping with the queued work until it is done
+    void wait(std::future<void> &result);
+
+    // Calls f(i) for every i in [begin, end), split into chunks of at least grain_size indices
+    template <typename F>
+    void parallel_for(size_t begin, size_t end, size_t grain_size, const F &f)
+    {
+        if (end <= begin)
+            return;
+        size_t n_chunks = std::min((end - begin + grain_size - 1) / grain_size, (size_t)4 * (size() + 1));
+        if (n_chunks <= 1)
+        {
+            for (size_t i = begin; i < end; i++)
+                f(i);
+            return;
+        }
+
+        size_t chunk_size = (end - begin + n_chunks - 1) / n_chunks;
+        std::vector<std::future<void>> results;
+        for (size_t chunk_begin = begin + chunk_size; chunk_begin < end; chunk_begin += chunk_size)
+        {
+            size_t chunk_end = std::min(chunk_begin + chunk_size, end);
+            results.push_back(submit([&f, chunk_begin, chunk_end]
+                                     { for (size_t i = chunk_begin; i < chunk_end; i++) f(i); }));
+        }
+        for (size_t i = begin; i < begin + chunk_size; i++)
+            f(i);
+        for (auto &result : results)
+            wait(result);
+    }
+};
\ No newline at end of file
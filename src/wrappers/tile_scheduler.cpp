@@ -0,0 +1,145 @@
+#include <algorithm>
+#include <cmath>
+
+#include "tile_scheduler.h"
+
+// The point at distance d along the Hilbert curve filling an n x n grid, n a power of two
+static void hilbert_point(int n, int d, int &x, int &y)
+{
+    x = y = 0;
+    for (int s = 1; s < n; s *= 2)
+    {
+        int rx = 1 & (d / 2);
+        int ry = 1 & (d ^ rx);
+        if (ry == 0)
+        {
+            if (rx == 1)
+            {
+                x = s - 1 - x;
+                y = s - 1 - y;
+            }
+            std::swap(x, y);
+        }
+        x += s * rx;
+        y += s * ry;
+        d /= 4;
+    }
+}
+
+TileScheduler::TileScheduler(int image_width, int image_height, int tile_size, int num_threads, int nr_passes, TileOrder order)
+    : nr_passes(nr_passes)
+{
+    int tiles_x = (image_width + tile_size - 1) / tile_size;
+    int tiles_y = (image_height + tile_size - 1) / tile_size;
+    int nr_tiles = tiles_x * tiles_y;
+
+    // The tiles in render order, as column and row in the grid of tiles
+    std::vector<std::pair<int, int>> grid;
+    grid.reserve(nr_tiles);
+    if (order == HILBERT)
+    {
+        int n = 1;
+        while (n < tiles_x || n < tiles_y)
+            n *= 2;
+        for (int d = 0; d < n * n; d++)
+        {
+            int x, y;
+            hilbert_point(n, d, x, y);
+            if (x < tiles_x && y < tiles_y)
+                grid.emplace_back(x, y);
+        }
+    }
+    else
+    {
+        // Ring by ring around the centre tile, each ring going around once
+        for (int y = 0; y < tiles_y; y++)
+            for (int x = 0; x < tiles_x; x++)
+                grid.emplace_back(x, y);
+        float cx = 0.5f * (tiles_x - 1), cy = 0.5f * (tiles_y - 1);
+        auto ring = [&](const std::pair<int, int> &t)
+        { return (int)std::ceil(std::max(std::fabs(t.first - cx), std::fabs(t.second - cy))); };
+        auto angle = [&](const std::pair<int, int> &t)
+        { return std::atan2(t.second - cy, t.first - cx); };
+        std::stable_sort(grid.begin(), grid.end(), [&](const std::pair<int, int> &a, const std::pair<int, int> &b)
+                         { return ring(a) != ring(b) ? ring(a) < ring(b) : angle(a) < angle(b); });
+    }
+
+    for (int i = 0; i < nr_tiles; i++)
+    {
+        int x = grid[i].first * tile_size, y = grid[i].second * tile_size;
+        tiles.push_back({x, y, std::min(tile_size, image_width - x), std::min(tile_size, image_height - y), i});
+    }
+    tile_mutexes = std::make_unique<std::mutex[]>(nr_tiles);
+
+    num_threads = std::max(num_threads, 1);
+    for (int t = 0; t < num_threads; t++)
+        queues.push_back(std::make_unique<Queue>());
+    if (nr_passes > 0)
+        deal_pass(0);
+}
+
+void TileScheduler::deal_pass(int pass)
+{
+    int n = queues.size(), nr_tiles = tiles.size();
+    for (int t = 0; t < n; t++)
+    {
+        Queue &queue = *queues[t];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.pass = pass;
+        for (int i = (long long)t * nr_tiles / n; i < (long long)(t + 1) * nr_tiles / n; i++)
+            queue.tiles.push_back(i);
+    }
+}
+
+bool TileScheduler::take_tile(int thread, Tile &tile, int &pass)
+{
+    {
+        Queue &own = *queues[thread];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.tiles.empty())
+        {
+            tile = tiles[own.tiles.front()];
+            pass = own.pass;
+            own.tiles.pop_front();
+            return true;
+        }
+    }
+
+    // Steal the tile furthest from where the owner is working
+    int n = queues.size();
+    for (int i = 1; i < n; i++)
+    {
+        Queue &victim = *queues[(thread + i) % n];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.tiles.empty())
+        {
+            tile = tiles[victim.tiles.back()];
+            pass = victim.pass;
+            victim.tiles.pop_back();
+            stolen.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool TileScheduler::next_tile(int thread, Tile &tile, int &pass)
+{
+    while (!take_tile(thread, tile, pass))
+    {
+        // Every queue looked empty: deal out the next pass, unless another thread already did
+        std::lock_guard<std::mutex> lock(pass_mutex);
+        bool all_empty = true;
+        for (auto &queue : queues)
+        {
+            std::lock_guard<std::mutex> queue_lock(queue->mutex);
+            all_empty &= queue->tiles.empty();
+        }
+        if (!all_empty)
+            continue;
+        if (current_pass + 1 >= nr_passes)
+            return false;
+        deal_pass(++current_pass);
+    }
+    return true;
+}
@@ -0,0 +1,68 @@
+#pragma once
+#include <mutex>
+#include <deque>
+#include <vector>
+#include <memory>
+#include <atomic>
+
+struct Tile
+{
+    int x, y; // top left pixel
+    int width, height;
+    int index; // position in the render order
+};
+
+enum TileOrder
+{
+    SPIRAL, // outwards from the centre of the image, where the subject usually is
+    HILBERT // along a Hilbert curve, consecutive tiles are always neighbours
+};
+
+/*
+ *  Cuts an image into square tiles and hands them out, pass after pass, to a fixed number of render threads.
+ *  Every thread starts each pass with its own run of consecutive tiles in the chosen order and takes them
+ *  from the front; a thread that runs out steals from the back of another one's run, so expensive
+ *  regions of the image don't leave the other threads idle. Once every tile of a pass has been handed out,
+ *  the next pass is dealt out right away instead of waiting for the last tiles to be finished, so the
+ *  same tile can be handed out for two passes at once: lock tile_mutex() while rendering it.
+ */
+class TileScheduler
+{
+public:
+    TileScheduler(int image_width, int image_height, int tile_size, int num_threads, int nr_passes = 1, TileOrder order = SPIRAL);
+
+    TileScheduler(TileScheduler &other) = delete;
+    void operator=(const TileScheduler &) = delete;
+
+    // The next tile for the given thread and the pass it is for. Returns false once every tile of the last pass has been handed out.
+    bool next_tile(int thread, Tile &tile, int &pass);
+
+    // Held by the thread rendering the tile, since the film takes only one thread per pixel at a time
+    std::mutex &tile_mutex(const Tile &tile) { return tile_mutexes[tile.index]; }
+
+    int tile_count() const { return tiles.size(); }
+
+    // Tiles rendered by another thread than the one they were first given to
+    int stolen_count() const { return stolen.load(std::memory_order_relaxed); }
+
+private:
+    struct Queue
+    {
+        std::mutex mutex;
+        std::deque<int> tiles; // indices into tiles, all of the same pass
+        int pass = 0;
+    };
+
+    std::vector<Tile> tiles; // in render order
+    std::unique_ptr<std::mutex[]> tile_mutexes;
+    std::vector<std::unique_ptr<Queue>> queues;
+    int nr_passes;
+    std::mutex pass_mutex; // taken to deal out the next pass
+    int current_pass = 0;  // owned by pass_mutex
+    std::atomic<int> stolen{0};
+
+    bool take_tile(int thread, Tile &tile, int &pass);
+
+    // Splits the tiles of a pass between the queues, which must be empty
+    void deal_pass(int pass);
+};